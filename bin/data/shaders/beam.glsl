@@ -0,0 +1,33 @@
+// the math of the beam, shared by the shaders that draw it.
+// src/util/BeamMath.cpp has the same approximations for the cpu, keep the two in sync.
+#define EPS 1E-6
+#define TAUR 2.5066282746310002
+#define SQRT2 1.4142135623730951
+
+float beamGaussian(float x, float sigma) {
+    return exp(-(x * x) / (2.0 * sigma * sigma)) / (TAUR * sigma);
+}
+
+// abramowitz-stegun 7.1.27, absolute error < 5e-4
+float beamErf(float x) {
+    float s = sign(x), a = abs(x);
+    x = 1.0 + (0.278393 + (0.230389 + (0.000972 + 0.078108 * a) * a) * a) * a;
+    x *= x;
+    return s - s / (x * x);
+}
+
+// the beam's alpha at xy (along, across) of a segment with length len
+float beamAlpha(vec2 xy, float len, float size, float intensity) {
+    float alpha;
+    float sigma = size/(2.0+2.0*1000.0*size/50.0);
+    if (len < EPS) {
+    // If the beam segment is too short, just calculate intensity at the position.
+        alpha = exp(-dot(xy,xy)/(2.0*sigma*sigma))/2.0/sqrt(size);
+    } else {
+    // Otherwise, use analytical integral for accumulated intensity.
+        alpha = beamErf(xy.x/SQRT2/sigma) - beamErf((xy.x-len)/SQRT2/sigma);
+        alpha *= exp(-xy.y*xy.y/(2.0*sigma*sigma))/2.0/len*size;
+    }
+    float intens = max(0.0,intensity-0.4)*0.7-1000.0*size/500.0;
+    return pow(max(alpha,0.0),1.0-intens)*(0.01+min(0.99,intensity*3.0));
+}
@@ -0,0 +1,38 @@
+#version 120
+#define EPS 1E-6
+// the raw samples, one per texel (position and weight)
+uniform sampler2D uSamples;
+uniform vec2 uSamplesSize;
+uniform mat4 uMatrix;
+uniform float uSize;
+varying vec4 color;
+
+vec3 sampleAt(float i){
+	vec2 uv = (vec2(mod(i, uSamplesSize.x), floor(i/uSamplesSize.x)) + 0.5)/uSamplesSize;
+	return texture2DLod(uSamples, uv, 0.0).xyz;
+}
+
+// gl_Vertex is (segment, along, side).
+// segment i goes from sample i to i+1, along picks the end and side the edge of the quad.
+// this is the same quad the cpu builds (see TraceMeshBuilder.cpp).
+void main()
+{
+	float i = gl_Vertex.x;
+	float along = gl_Vertex.y;
+	float side = gl_Vertex.z;
+	
+	vec2 p0 = sampleAt(i).xy;
+	vec3 s1 = sampleAt(i+1.0);
+	vec2 p1 = s1.xy;
+	vec2 dir = p1 - p0;
+	float z = length(dir);
+	if (z > EPS) dir /= z;
+	else dir = vec2(1.0, 0.0);
+	
+	dir *= uSize;
+	vec2 norm = vec2(-dir.y, dir.x);
+	vec2 pos = mix(p0-dir, p1+dir, along) + side*norm;
+	
+	gl_Position = uMatrix*vec4(pos, 0.0, 1.0);
+	color = vec4(mix(-uSize, z+uSize, along), side*uSize, z, s1.z);
+}
@@ -0,0 +1,32 @@
+#version 110
+// the float accumulation buffer, brightness can go way beyond 1
+uniform sampler2D uAccum;
+// one pixel in texture coordinates
+uniform vec2 uPixel;
+// how much the glow adds (0...1) and how far it reaches (pixels)
+uniform float uBloom;
+uniform float uRadius;
+varying vec2 texCoord;
+
+// like film: linear for faint beams, saturates smoothly where they pile up
+vec3 tonemap(vec3 c){
+	return 1.0 - exp(-c);
+}
+
+void main (void)
+{
+	vec3 c = texture2D(uAccum, texCoord).rgb;
+	
+	if (uBloom > 0.0) {
+		// twelve taps on two rings, a cheap wide blur. bright spots bleed into their surroundings.
+		vec3 glow = vec3(0.0);
+		for (int i = 0; i < 12; i++) {
+			float a = float(i)*0.5235988;
+			float r = (mod(float(i), 2.0) < 0.5? 0.5 : 1.0)*uRadius;
+			glow += texture2D(uAccum, texCoord + vec2(cos(a), sin(a))*r*uPixel).rgb;
+		}
+		c += glow/12.0*uBloom;
+	}
+	
+	gl_FragColor = vec4(tonemap(c), 1.0);
+}
@@ -0,0 +1,14 @@
+#pragma include "../../../../bin/data/shaders/beam.glsl"
+uniform vec2 uOrigin;
+uniform vec2 uStep;
+uniform float uLen;
+uniform float uSize;
+uniform float uIntensity;
+
+// beam.glsl's alpha into the red channel, for check/src/ofApp.cpp
+void main (void)
+{
+	// one sample per pixel, like beam_row: origin + index*step
+	vec2 xy = uOrigin + floor(gl_FragCoord.xy)*uStep;
+	gl_FragColor = vec4(beamAlpha(xy, uLen, uSize, uIntensity), 0.0, 0.0, 1.0);
+}
@@ -0,0 +1,2 @@
+// the app's sources are outside of this project folder, pull them in here.
+#include "../../src/util/OsciAvAudioPlayer.cpp"
@@ -0,0 +1,21 @@
+#include "ofMain.h"
+#include "ofApp.h"
+
+#if defined(__linux__)
+#include "ofAppGlutWindow.h"
+#endif
+
+//========================================================================
+int main(){
+	// the window is only there for the gl context.
+	// glut on linux, like the app (see ../src/main.cpp)
+	#if defined(__linux__)
+	ofAppGlutWindow window;
+	ofSetupOpenGL(&window, 256, 64, OF_WINDOW);
+	#else
+	ofSetupOpenGL(256, 64, OF_WINDOW);
+	#endif
+	
+	// the exit code is the number of failed checks
+	return ofRunApp(new ofApp);
+}
@@ -0,0 +1,513 @@
+#include "ofApp.h"
+#include "../../src/util/Audio.h"
+#include "../../src/util/BeamMath.h"
+#include "../../src/util/OsciAvAudioPlayer.h"
+#include <chrono>
+#include <random>
+
+#define EPS 1E-6
+#define SQRT2 1.4142135623730951f
+
+// tolerances, see ../readme.md.
+// mean_abs sums up in a different order, everything else has to match exactly
+#define TOL_MEAN_ABS 1e-5
+// addTo with 10000 chunks queued vs. with one chunk
+#define TOL_ADD_TO_RATIO 3
+// the BeamMath ones are the error bounds from BeamMath.h
+#define TOL_ERF 5e-4
+#define TOL_EXP 1e-7
+#define TOL_LOG 1e-7
+#define TOL_GAUSSIAN 2e-5
+// the exporter has to land on the first sample of every video frame, exactly.
+// only the total length may be off a little when the cache is resampled.
+#define TOL_EXPORT_OFFSET 0
+#define TOL_EXPORT_LENGTH 32
+// the shader draws into an 8 bit fbo, so a quarter of one step (1/255) is invisible.
+// relative for alphas above 1.
+#define TOL_BEAM 1e-3
+
+// best of a few runs, in seconds
+template<typename F>
+static double bestTime( F f ){
+	double best = 1e30;
+	for( int run = 0; run < 5; run++ ){
+		auto start = chrono::steady_clock::now();
+		f();
+		best = MIN(best, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+	}
+	return best;
+}
+
+// the larger error, a nan counts as infinite
+static double worse( double error, double e ){
+	return e != e? INFINITY : MAX(error, e);
+}
+
+// stands in for the audio callback: plays numFrames frames (or until the file loops), as fast as the decoder keeps up.
+// returns false if it stalled.
+static bool playAsync( OsciAvAudioPlayer & player, int numFrames, bool untilLooped ){
+	float buffer[2*512];
+	int64_t lastPosition = player.getPositionSamples();
+	int stalled = 0;
+	for( int played = 0; played < numFrames && stalled < 5000; ){
+		int N = player.audioOut(buffer, 512, 2)/2;
+		player.stereo192.consume(player.stereo192.totalLength);
+		if( N == 0 ){
+			ofSleepMillis(1);
+			stalled++;
+			continue;
+		}
+		played += N;
+		stalled = 0;
+		
+		int64_t position = player.getPositionSamples();
+		if( untilLooped && position < lastPosition ) return true;
+		lastPosition = position;
+	}
+	return !untilLooped && stalled < 5000;
+}
+
+// exports the file the way ofApp::update() does, at 60 fps.
+// offset is the largest distance between where a video frame should start and where the player ended up,
+// length is how many frames were read in total.
+static void exportFile( OsciAvAudioPlayer & player, int64_t & offset, int64_t & length ){
+	const int fps = 60;
+	const int bufferSize = 512;
+	float output[2*bufferSize];
+	
+	player.beginSync(bufferSize);
+	player.setPositionMS(0);
+	player.setLoop(false);
+	player.play();
+	
+	offset = 0;
+	length = 0;
+	bool ended = false;
+	for( int frame = 0; !ended; frame++ ){
+		int64_t targetFrame = frame*(int64_t)player.getSampleRate()/fps;
+		int64_t missing;
+		while( !ended && (missing = targetFrame - player.getPositionSamples()) > 0 ){
+			int N = (int)MIN((int64_t)bufferSize, missing);
+			int read = player.audioOutSync(output, N, 2);
+			length += read;
+			ended = read == 0;
+		}
+		// in sync mode the render stream goes straight to stereo192
+		player.stereo192.consume(player.stereo192.totalLength);
+		
+		if( !ended ){
+			offset = MAX(offset, llabs(player.getPositionSamples() - targetFrame));
+			// and that has to be what was read, not just what the player claims
+			offset = MAX(offset, llabs(length - targetFrame));
+		}
+	}
+	
+	player.endSync();
+	player.setLoop(true);
+}
+
+// the same setup as BeamRenderer::rasterize (with a weight of 1)
+static BeamMath::Beam makeBeam( float uSize, float uIntensity, float len ){
+	float sigma = uSize/(2.0f+2.0f*1000.0f*uSize/50.0f);
+	float intens = MAX(0.0f, uIntensity-0.4f)*0.7f - 1000.0f*uSize/500.0f;
+
+	BeamMath::Beam beam;
+	bool dot = len < EPS;
+	beam.len = dot? 0 : len;
+	beam.invS = 1.0f/(SQRT2*sigma);
+	beam.inv2s2 = 1.0f/(2.0f*sigma*sigma);
+	beam.scale = dot? 0.5f/sqrtf(uSize) : 0.5f/len*uSize;
+	beam.exponent = 1.0f-intens;
+	beam.gain = 0.01f + MIN(0.99f, uIntensity*3.0f);
+	return beam;
+}
+
+
+//--------------------------------------------------------------
+void ofApp::setup(){
+	failures = 0;
+
+	checkAudioAlgo();
+	checkMonoSample();
+	checkExport();
+	checkBeamMath();
+	checkBeamShader();
+
+	printf("\n%d check(s) failed\n", failures);
+	ofExit(failures);
+}
+
+//--------------------------------------------------------------
+void ofApp::checkAudioAlgo(){
+	const AudioAlgo::Kernels & k = AudioAlgo::kernels();
+	const AudioAlgo::Kernels & scalar = AudioAlgo::scalarKernels();
+	printf("\nAudioAlgo (%s kernels)\n", k.name);
+	
+	// lengths around the vector widths, so the tails get their turn
+	mt19937 rng(1);
+	uniform_real_distribution<float> range(-1, 1);
+	int wrong = 0;
+	double meanError = 0;
+	for( int N : {0, 1, 3, 7, 8, 15, 16, 17, 31, 33, 1023, 4096} ){
+		// +1, so the element after the end can be checked
+		vector<float> source(2*N+1);
+		vector<uint8_t> bytes(3*N+1);
+		for( float & x : source ) x = range(rng);
+		for( uint8_t & b : bytes ) b = rng();
+		vector<float> a(2*N+1), b(2*N+1), a2(N+1), b2(N+1);
+		
+		if( k.max_abs(source.data(), N) != scalar.max_abs(source.data(), N) ) wrong++;
+		float mean = scalar.mean_abs(source.data(), N);
+		meanError = worse(meanError, fabs(k.mean_abs(source.data(), N) - mean)/MAX(mean, 1e-30f));
+		
+		k.copy(a.data(), 1, source.data()+1, 2, N);
+		scalar.copy(b.data(), 1, source.data()+1, 2, N);
+		wrong += a != b;
+		
+		k.copy(a.data(), 2, source.data(), 1, N);
+		scalar.copy(b.data(), 2, source.data(), 1, N);
+		wrong += a != b;
+		
+		a = b = source;
+		k.scale(a.data(), 0.3f, 2*N);
+		scalar.scale(b.data(), 0.3f, 2*N);
+		wrong += a != b;
+		
+		k.deinterleave(a.data(), a2.data(), source.data(), N);
+		scalar.deinterleave(b.data(), b2.data(), source.data(), N);
+		wrong += a != b || a2 != b2;
+		
+		k.int16_to_float(a.data(), (const int16_t*)bytes.data(), N);
+		scalar.int16_to_float(b.data(), (const int16_t*)bytes.data(), N);
+		wrong += a != b;
+		
+		k.int24_to_float(a.data(), bytes.data(), N);
+		scalar.int24_to_float(b.data(), bytes.data(), N);
+		wrong += a != b;
+	}
+	report("runs that differ", wrong, 0);
+	report("mean_abs, rel. error", meanError, TOL_MEAN_ABS);
+	
+	// one block of 2048 stereo frames, like the mic and the decoder deliver them
+	const int N = 2048;
+	vector<float> source(2*N), left(N), right(N);
+	vector<uint8_t> bytes(3*2*N);
+	for( float & x : source ) x = range(rng);
+	for( uint8_t & b : bytes ) b = rng();
+	const char * names[] = {"mean_abs", "max_abs", "copy (one channel)", "scale", "deinterleave", "int16_to_float", "int24_to_float"};
+	printf("\n  ns per block of %d frames  %10s %10s    speedup\n", N, scalar.name, k.name);
+	for( int step = 0; step < 7; step++ ){
+		double ns[2];
+		for( int j = 0; j < 2; j++ ){
+			const AudioAlgo::Kernels & kk = j == 0? scalar : k;
+			const int calls = 1000;
+			volatile float sink = 0;
+			double t = bestTime([&](){
+				for( int i = 0; i < calls; i++ ){
+					switch( step ){
+						case 0: sink = kk.mean_abs(source.data(), 2*N); break;
+						case 1: sink = kk.max_abs(source.data(), 2*N); break;
+						case 2: kk.copy(left.data(), 1, source.data(), 2, N); break;
+						case 3: kk.scale(source.data(), 1.0f, 2*N); break;
+						case 4: kk.deinterleave(left.data(), right.data(), source.data(), N); break;
+						case 5: kk.int16_to_float(source.data(), (const int16_t*)bytes.data(), 2*N); break;
+						case 6: kk.int24_to_float(source.data(), bytes.data(), 2*N); break;
+					}
+				}
+			});
+			ns[j] = t/calls*1e9;
+		}
+		printf("  %-26s %10.1f %10.1f %9.1fx\n", names[step], ns[0], ns[1], ns[0]/ns[1]);
+	}
+}
+
+//--------------------------------------------------------------
+void ofApp::checkMonoSample(){
+	printf("\nMonoSample::addTo\n");
+	
+	// chunk sizes that don't line up with the reads, every sample has to come back in order
+	{
+		MonoSample sample;
+		float buffer[777];
+		float value = 0;
+		for( int i = 0; i < 50; i++ ){
+			for( float & x : buffer ) x = value++;
+			sample.append(buffer, 777);
+		}
+		
+		sample.play();
+		float out[500];
+		int wrong = 0;
+		value = 0;
+		while( sample.totalLength >= 500 ){
+			memset(out, 0, sizeof(out));
+			wrong += sample.addTo(out, 1, 500) != 500;
+			for( float x : out ) wrong += x != value++;
+			sample.peel(500);
+		}
+		report("wrong samples", wrong, 0);
+	}
+	
+	// play 256 samples at a time, over and over, with more and more 512 sample chunks queued
+	printf("\n  chunks      ns per addTo(256)\n");
+	double first = 0;
+	double ratio = 0;
+	for( int chunks : {1, 10, 100, 1000, 10000} ){
+		MonoSample sample;
+		float buffer[512] = {0};
+		for( int i = 0; i < chunks; i++ ){
+			sample.append(buffer, 512);
+		}
+		
+		sample.play();
+		float out[256];
+		const int calls = 100000;
+		double t = bestTime([&](){
+			for( int i = 0; i < calls; i++ ){
+				if( sample.playbackIndex + 256 > sample.totalLength ) sample.playbackIndex = 0;
+				sample.addTo(out, 1, 256);
+			}
+		});
+		
+		double ns = t/calls*1e9;
+		printf("  %6d %16.1f\n", chunks, ns);
+		if( chunks == 1 ) first = ns;
+		ratio = worse(ratio, ns/first);
+	}
+	report("slowest vs. one chunk", ratio, TOL_ADD_TO_RATIO);
+}
+
+//--------------------------------------------------------------
+void ofApp::checkExport(){
+	printf("\nOsciAvAudioPlayer export\n");
+	
+	// the app's test file, 201332 frames at 44.1kHz
+	string fileName = "../../../bin/data/konichiwa.wav";
+	const int64_t fileFrames = 201332;
+	const int fileRate = 44100;
+	int64_t offset, length;
+	
+	// the player keeps the end of the file queued when it loops, that must not count for the export
+	{
+		OsciAvAudioPlayer player;
+		player.setupAudioOut(2, fileRate, true);
+		if( !player.loadSound(fileName) ){
+			printf("  couldn't load %s\n", fileName.c_str());
+			failures++;
+			return;
+		}
+		player.setLoop(true);
+		player.play();
+		bool looped = playAsync(player, 4*fileFrames, true);
+		report("played until looped", looped? 0 : 1, 0);
+		
+		exportFile(player, offset, length);
+		report("after a loop: frame offset", offset, TOL_EXPORT_OFFSET);
+		report("after a loop: length", llabs(length - fileFrames), TOL_EXPORT_LENGTH);
+		
+		// same after a seek, with the audio from before it still queued
+		player.setPositionMS(3000);
+		playAsync(player, 4096, false);
+		exportFile(player, offset, length);
+		report("after a seek: frame offset", offset, TOL_EXPORT_OFFSET);
+		report("after a seek: length", llabs(length - fileFrames), TOL_EXPORT_LENGTH);
+	}
+	
+	// the same from the decode cache, resampled to 48kHz on the way out
+	{
+		const int rate = 48000;
+		OsciAvAudioPlayer player;
+		player.setDecodeCacheSize(64<<20);
+		player.setupAudioOut(2, rate, true);
+		player.loadSound(fileName);
+		player.setLoop(true);
+		player.play();
+		for( int i = 0; i < 1000 && !player.isCached(); i++ ){
+			playAsync(player, 512, false);
+		}
+		report("cached", player.isCached()? 0 : 1, 0);
+		bool looped = playAsync(player, 4*fileFrames*rate/fileRate, true);
+		report("played until looped", looped? 0 : 1, 0);
+		
+		exportFile(player, offset, length);
+		report("cached: frame offset", offset, TOL_EXPORT_OFFSET);
+		report("cached: length", llabs(length - fileFrames*rate/fileRate), TOL_EXPORT_LENGTH);
+	}
+}
+
+//--------------------------------------------------------------
+void ofApp::checkBeamMath(){
+	const BeamMath::Kernels & k = BeamMath::kernels();
+	const BeamMath::Kernels & scalar = BeamMath::scalarKernels();
+	printf("\nBeamMath (%s kernels)\n", k.name);
+
+	const int N = 1<<20;
+	mt19937 rng(1);
+	vector<float> in(N), out(N), ref(N);
+	double error;
+	int differ;
+
+	// erf, absolute error
+	uniform_real_distribution<float> erfRange(-6, 6);
+	for( float & x : in ) x = erfRange(rng);
+	k.erf(out.data(), in.data(), N);
+	scalar.erf(ref.data(), in.data(), N);
+	error = 0;
+	differ = 0;
+	for( int i = 0; i < N; i++ ){
+		error = worse(error, fabs(out[i] - erf((double)in[i])));
+		differ += out[i] != ref[i];
+	}
+	report("erf, abs. error", error, TOL_ERF);
+	printf("    %d results differ from the scalar kernel\n", differ);
+
+	// exp, relative error
+	uniform_real_distribution<float> expRange(-87, 88);
+	for( float & x : in ) x = expRange(rng);
+	k.exp(out.data(), in.data(), N);
+	scalar.exp(ref.data(), in.data(), N);
+	error = 0;
+	differ = 0;
+	for( int i = 0; i < N; i++ ){
+		double e = exp((double)in[i]);
+		error = worse(error, fabs(out[i] - e)/e);
+		differ += out[i] != ref[i];
+	}
+	report("exp, rel. error", error, TOL_EXP);
+	printf("    %d results differ from the scalar kernel\n", differ);
+
+	// log, absolute error. there is no array version, the kernels only use it inside beam_row.
+	uniform_real_distribution<float> logRange(-30, 30);
+	error = 0;
+	for( int i = 0; i < N; i++ ){
+		float x = expf(logRange(rng));
+		error = worse(error, fabs(BeamMath::log(x) - log((double)x)));
+	}
+	report("log, abs. error", error, TOL_LOG);
+
+	// gaussian, relative error out to 8 sigma
+	float sigma = 0.004f;
+	uniform_real_distribution<float> gaussRange(-8*sigma, 8*sigma);
+	for( float & x : in ) x = gaussRange(rng);
+	k.gaussian(out.data(), in.data(), sigma, N);
+	scalar.gaussian(ref.data(), in.data(), sigma, N);
+	error = 0;
+	differ = 0;
+	for( int i = 0; i < N; i++ ){
+		double x = in[i];
+		double g = exp(-x*x/(2.0*sigma*sigma))/(2.5066282746310002*sigma);
+		error = worse(error, fabs(out[i] - g)/g);
+		differ += out[i] != ref[i];
+	}
+	report("gaussian, rel. error", error, TOL_GAUSSIAN);
+	printf("    %d results differ from the scalar kernel\n", differ);
+
+	// throughput
+	for( float & x : in ) x = erfRange(rng)*0.1f;
+	BeamMath::Beam beam = makeBeam(0.01f, 0.6f, 0.03f);
+	const char * names[] = {"erf", "exp", "gaussian", "beam_row (64 px rows)"};
+	printf("\n  throughput in Mevals/s      %10s %10s\n", scalar.name, k.name);
+	for( int step = 0; step < 4; step++ ){
+		double mevals[2];
+		for( int j = 0; j < 2; j++ ){
+			const BeamMath::Kernels & kk = j == 0? scalar : k;
+			double t = bestTime([&](){
+				switch( step ){
+					case 0: kk.erf(out.data(), in.data(), N); break;
+					case 1: kk.exp(out.data(), in.data(), N); break;
+					case 2: kk.gaussian(out.data(), in.data(), 0.01f, N); break;
+					case 3:
+						for( int i = 0; i < N; i += 64 ){
+							kk.beam_row(out.data()+i, -0.01f, 0.0007f, 0.001f, 0.00001f, beam, 64);
+						}
+						break;
+				}
+			});
+			mevals[j] = N/t/1e6;
+		}
+		printf("  %-26s %10.1f %10.1f\n", names[step], mevals[0], mevals[1]);
+	}
+
+	double t = bestTime([&](){
+		for( int i = 0; i < N; i++ ) out[i] = std::erf(in[i]);
+	});
+	printf("  %-26s %10.1f\n", "std::erf, for comparison", N/t/1e6);
+}
+
+//--------------------------------------------------------------
+void ofApp::checkBeamShader(){
+	printf("\nbeam.glsl on the gpu vs BeamMath (%s kernels)\n", BeamMath::kernels().name);
+
+	// bin/data/shaders/beam_check.frag includes beam.glsl from the app
+	ofShader shader;
+	bool ok = shader.load("shaders/beam_check");
+	if( !ok ){
+		printf("  couldn't load or compile the shader\n");
+		failures++;
+		return;
+	}
+
+	// float fbo, so the gpu results come back unrounded
+	const int W = 256;
+	const int H = 64;
+	ofFbo fbo;
+	fbo.allocate(W, H, GL_RGBA32F);
+	ofFloatPixels pixels;
+	float alpha[W];
+	ofDisableAlphaBlending();
+
+	// dots and lines, thin to wide, dim to bright
+	double error = 0;
+	int cases = 0;
+	for( float uSize : {0.003f, 0.01f, 0.02f} ){
+		for( float uIntensity : {0.2f, 0.5f, 1.0f} ){
+			for( float len : {0.0f, 0.002f, 0.05f} ){
+				// cover the segment and four times its size around it
+				float x0 = -4*uSize;
+				float y0 = -4*uSize;
+				float dx = (len + 8*uSize)/W;
+				float dy = 8*uSize/H;
+
+				fbo.begin();
+				ofClear(0, 0, 0, 0);
+				shader.begin();
+				shader.setUniform2f("uOrigin", x0, y0);
+				shader.setUniform2f("uStep", dx, dy);
+				shader.setUniform1f("uLen", len);
+				shader.setUniform1f("uSize", uSize);
+				shader.setUniform1f("uIntensity", uIntensity);
+				ofDrawRectangle(0, 0, W, H);
+				shader.end();
+				fbo.end();
+				fbo.readToPixels(pixels);
+
+				// rows come back bottom up, the same way gl_FragCoord counts them
+				BeamMath::Beam beam = makeBeam(uSize, uIntensity, len);
+				double caseError = 0;
+				for( int j = 0; j < H; j++ ){
+					BeamMath::kernels().beam_row(alpha, x0, dx, y0 + dy*j, 0, beam, W);
+					for( int i = 0; i < W; i++ ){
+						float gpu = pixels.getData()[(j*W + i)*pixels.getNumChannels()];
+						caseError = worse(caseError, fabs(gpu - alpha[i])/MAX(1.0f, fabsf(alpha[i])));
+					}
+				}
+
+				if( !(caseError <= TOL_BEAM) ){
+					printf("    size %g, intensity %g, len %g: error %.3g\n", uSize, uIntensity, len, caseError);
+				}
+				error = MAX(error, caseError);
+				cases++;
+			}
+		}
+	}
+
+	ofEnableAlphaBlending();
+	report("alpha, " + ofToString(cases) + " beams of " + ofToString(W) + "x" + ofToString(H) + " px", error, TOL_BEAM);
+}
+
+//--------------------------------------------------------------
+void ofApp::report( string name, double value, double tolerance ){
+	bool ok = value <= tolerance;
+	printf("  %-26s %10.3g   tolerance %-8.3g %s\n", name.c_str(), value, tolerance, ok? "ok" : "FAILED");
+	if( !ok ) failures++;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "ofMain.h"
+
+// runs all checks in setup() and quits.
+// every check prints what it measured next to its tolerance (see ../readme.md),
+// the number of failed checks becomes the exit code.
+class ofApp : public ofBaseApp{
+
+	public:
+		void setup();
+
+	private:
+		// AudioAlgo's simd kernels against the scalar ones, and their speed
+		void checkAudioAlgo();
+		// MonoSample::addTo has to cost the same no matter how many chunks are queued
+		void checkMonoSample();
+		// exports from the player (like ofApp::update() does) have to read exactly up to every video frame
+		void checkExport();
+		// BeamMath's kernels against double precision, and their throughput
+		void checkBeamMath();
+		// shaders/beam.glsl on the gpu against BeamMath's beam_row
+		void checkBeamShader();
+
+		// prints one result and counts it as failed if it's above the tolerance
+		void report( string name, double value, double tolerance );
+
+		int failures;
+};
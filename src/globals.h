@@ -20,7 +20,12 @@ extern void setWindowRepresentedFilename( string filename );
 #define globals (Globals::instance)
 class Globals{
 public:
-	Globals(){}
+	Globals(){
+		// extra channel pairs get their own colors
+		for( int i = 0; i < VISUAL_MAX_PAIRS; i++ ){
+			traces[i].hue = i*90;
+		}
+	}
 	
 	// audio settings
 	bool autoDetect{true};
@@ -30,6 +35,10 @@ public:
 	int deviceId{0};
 	int micDeviceId{-1};
 	bool micActive{false};
+	int readAheadMs{100}; // how far the decoder runs ahead of playback
+	int visualReadAheadMs{100}; // same for the render stream
+	int decodeCacheMb{0}; // files up to this size are decoded completely in memory (0 = off)
+	int diskCacheMb{0}; // decoded files are kept on disk up to this size (0 = off)
 	
 	// display settings
 	float scale{1.0};
@@ -39,13 +48,29 @@ public:
 	
 	float strokeWeight{10}; // 1...20
 	float timeStretch{1}; // 0.1-2.0
-	float blur{30}; // 0...255
+	float blur{30}; // 0...255, the glow around bright spots (only with hdr)
 	float intensity{0.4f}; // 0...1
 	float afterglow{0.5f}; // 0...1
 	
 	int numPts{20}; // 1...+inf?
 	float hue{50}; // 0...360
 	
+	// files with several channel pairs are drawn as several traces.
+	// these are on top of the settings above, trace 0 is also used for stereo files.
+	struct Trace{
+		float hue{0}; // added to hue
+		float intensity{1}; // multiplies intensity
+		float scale{1};
+		float rotation{0}; // degrees
+		float offsetX{0};
+		float offsetY{0};
+	};
+	Trace traces[VISUAL_MAX_PAIRS];
+	bool tileTraces{false}; // each trace in its own tile, instead of all on top of each other
+	bool hdr{false}; // accumulate in a float buffer and tone map, instead of 8 bit
+	bool cpuBeam{false}; // render the beam on the cpu (slow, but needs no shaders. also the reference for them)
+	bool gpuQuads{true}; // build the line quads in the vertex shader (falls back to the cpu if that shader doesn't load)
+	
 	float outputVolume{1};
 	float inputVolume{1};
 	
@@ -61,6 +86,10 @@ public:
 		sampleRate = settings.get("sampleRate",  sampleRate );
 		numBuffers = settings.get( "numBuffers", numBuffers );
 		deviceId = settings.get( "deviceId", deviceId );
+		readAheadMs = settings.get( "readAheadMs", readAheadMs );
+		visualReadAheadMs = settings.get( "visualReadAheadMs", visualReadAheadMs );
+		decodeCacheMb = settings.get( "decodeCacheMb", decodeCacheMb );
+		diskCacheMb = settings.get( "diskCacheMb", diskCacheMb );
 		scale = settings.get( "scale", scale );
 		flipXY = settings.get( "flipXY", flipXY );
 		invertX = settings.get( "invertX", invertX );
@@ -73,6 +102,19 @@ public:
 		blur = settings.get( "blur", blur );
 		numPts = settings.get( "numPts", numPts );
 		hue = settings.get( "hue", hue );
+		for( int i = 0; i < VISUAL_MAX_PAIRS; i++ ){
+			string key = "trace" + ofToString(i+1);
+			traces[i].hue = settings.get( key + "Hue", traces[i].hue );
+			traces[i].intensity = settings.get( key + "Intensity", traces[i].intensity );
+			traces[i].scale = settings.get( key + "Scale", traces[i].scale );
+			traces[i].rotation = settings.get( key + "Rotation", traces[i].rotation );
+			traces[i].offsetX = settings.get( key + "OffsetX", traces[i].offsetX );
+			traces[i].offsetY = settings.get( key + "OffsetY", traces[i].offsetY );
+		}
+		tileTraces = settings.get( "tileTraces", tileTraces );
+		gpuQuads = settings.get( "gpuQuads", gpuQuads );
+		hdr = settings.get( "hdr", hdr );
+		cpuBeam = settings.get( "cpuBeam", cpuBeam );
 		intensity = settings.get( "intensity", intensity );
 		afterglow = settings.get( "afterglow", afterglow );
 		exportFrameRate = settings.get( "exportFrameRate", exportFrameRate );
@@ -94,6 +136,10 @@ public:
 		settings.set( "sampleRate", sampleRate );
 		settings.set( "numBuffers", numBuffers );
 		settings.set( "deviceId", deviceId );
+		settings.set( "readAheadMs", readAheadMs );
+		settings.set( "visualReadAheadMs", visualReadAheadMs );
+		settings.set( "decodeCacheMb", decodeCacheMb );
+		settings.set( "diskCacheMb", diskCacheMb );
 		settings.set( "scale", scale );
 		settings.set( "flipXY", flipXY );
 		settings.set( "invertX", invertX );
@@ -106,6 +152,19 @@ public:
 		settings.set( "blur", blur );
 		settings.set( "numPts", numPts );
 		settings.set( "hue", hue );
+		for( int i = 0; i < VISUAL_MAX_PAIRS; i++ ){
+			string key = "trace" + ofToString(i+1);
+			settings.set( key + "Hue", traces[i].hue );
+			settings.set( key + "Intensity", traces[i].intensity );
+			settings.set( key + "Scale", traces[i].scale );
+			settings.set( key + "Rotation", traces[i].rotation );
+			settings.set( key + "OffsetX", traces[i].offsetX );
+			settings.set( key + "OffsetY", traces[i].offsetY );
+		}
+		settings.set( "tileTraces", tileTraces );
+		settings.set( "gpuQuads", gpuQuads );
+		settings.set( "hdr", hdr );
+		settings.set( "cpuBeam", cpuBeam );
 		settings.set( "intensity", intensity );
 		settings.set( "afterglow", afterglow );
 		settings.set( "exportFrameRate", exportFrameRate );
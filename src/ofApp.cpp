@@ -9,14 +9,15 @@ Poco::Mutex updateMutex;
 
 bool applicationRunning = false;
 
-#define EPS 1E-6
-
 //--------------------------------------------------------------
 void ofApp::setup(){
 	mui::MuiConfig::fontSize = 16;
 	showInfo = false;
-	dropped = 0;
 	changed = false;
+	drawGpu = false;
+	drawCpu = false;
+	lodScale = 1;
+	fboHdr = false;
 	clearFbos = false;
 	lastMouseMoved = 0;
 	exporting = 0;
@@ -31,6 +32,9 @@ void ofApp::setup(){
 //	shader.setGeometryOutputType(GL_QUADS);
 //	shader.setGeometryOutputCount(4);
 	shaderLoader.setup(&shader, "shaders/osci");
+	gpuShaderLoader.setup(&gpuShader, "shaders/osci_gpu", "shaders/osci");
+	resolveShaderLoader.setup(&resolveShader, "shaders/resolve");
+	meshBuilder.startThread();
 	
 	ofSetFrameRate(60);
 	
@@ -39,6 +43,8 @@ void ofApp::setup(){
 	globals.player.loadSound( ofxToReadonlyDataPath("konichiwa.wav") );
 	globals.player.setLoop(true);
 	globals.player.stop(); 
+	soundLoaded = false;
+	ofAddListener( globals.player.loadEvent, this, &ofApp::soundLoadedEvent );
 	
 	configView = new ConfigView();
 	configView->fromGlobals();
@@ -52,9 +58,6 @@ void ofApp::setup(){
 	osciView->visible = false;
 	root->add( osciView );
 	
-	left.loop = false;
-	right.loop = false;
-
 	
 	if( globals.autoDetect ){
 		startApplication();
@@ -69,8 +72,6 @@ void ofApp::startApplication(){
 	if( applicationRunning ) return;
 	applicationRunning = true;
 	cout << "starting ..." << endl; 
-	left.play();
-	right.play();
 
 	configView->toGlobals();
 	globals.saveToFile();
@@ -91,7 +92,10 @@ void ofApp::startApplication(){
 	
 	soundStream.setDeviceID( globals.deviceId );
 	soundStream.setup(this, 2, 0, globals.sampleRate, globals.bufferSize, globals.numBuffers);
+	globals.player.setDecodeCacheSize( (size_t)max(0,globals.decodeCacheMb)<<20 );
+	globals.player.setDiskCache( ofxToReadWriteableDataPath("pcmcache"), (size_t)max(0,globals.diskCacheMb)<<20 );
 	globals.player.setupAudioOut(2, globals.sampleRate, true);
+	globals.player.setReadAheadMS(globals.readAheadMs, globals.visualReadAheadMs);
 }
 
 
@@ -140,6 +144,19 @@ void ofApp::update(){
 		ofShowCursor();
 		return;
 	}
+	
+	// a new file was loaded in the background
+	if( soundLoaded.exchange(false) ){
+		globals.timeStretch = 1.0;
+		osciView->timeStretchSlider->slider->value = 1.0;
+	}
+	
+	// the playlist moves on by itself, keep the window title up to date
+	string fileName = globals.player.getFileName();
+	if( fileName != shownFileName ){
+		shownFileName = fileName;
+		setWindowRepresentedFilename(fileName);
+	}
 
 	if( ofGetElapsedTimeMillis()-lastMouseMoved < 3000 && osciView->visible == false ){
 		osciView->visible = true;
@@ -162,13 +179,11 @@ void ofApp::update(){
 		ofSleepMillis(1000);
 		
 		// reset drop count. this has no purpose, but gives the user a good feeling
-		dropped = 0;
+		meshBuilder.dropped = 0;
+		meshBuilder.decimated = 0;
 		
 		// resize&clear fbo
-		fbo.allocate(globals.exportWidth, globals.exportHeight, GL_RGBA);
-		fbo.begin();
-		ofClear(0,255);
-		fbo.end();
+		allocateFbo(globals.exportWidth, globals.exportHeight);
 		
 		// reset player
 		exporting = 2;
@@ -184,18 +199,21 @@ void ofApp::update(){
 		// we just eat the buffer into nirvana.
 		// our funky player will automatically place
 		exportFrameNum ++;
-		int targetTimeMS = exportFrameNum*1000.0/globals.exportFrameRate;
+		int64_t targetFrame = exportFrameNum*(int64_t)globals.player.getSampleRate()/globals.exportFrameRate;
 		const int bufferSize = 512;
 		static float * output = NULL;
 		if( output == NULL ) output = new float[2*bufferSize];
 		
-		int len;
-		do{
-			len = globals.player.audioOutSync(output, bufferSize, 2);
+		// read exactly up to the sample where this video frame starts
+		bool ended = false;
+		int64_t missing;
+		while( !ended && (missing = targetFrame - globals.player.getPositionSamples()) > 0 ){
+			int N = (int)min((int64_t)bufferSize, missing);
+			// a short read only means the decoder needs another round, nothing means the end
+			ended = globals.player.audioOutSync(output, N, 2) == 0;
 		}
-		while( globals.player.getPositionMS() < targetTimeMS && len > 0 );
 		
-		if( len == 0 ){
+		if( ended ){
 			// save this frame, then end it!
 			exporting = 3;
 		}
@@ -210,102 +228,48 @@ void ofApp::update(){
 	
 
 	/////////////////////////////////////////////////
-	// copy buffer data to the mesh
+	// pick up the meshes, one per channel pair.
+	// they are built on the mesh builder's thread, except when exporting.
 	
-	changed = false;
-	shapeMesh.clear();
-	shapeMesh.setMode(OF_PRIMITIVE_TRIANGLES);
-	shapeMesh.enableColors();
+	int numTraces = globals.micActive? 1 : globals.player.getNumVisualPairs();
+	vector<StereoSample*> sources;
+	for( int i = 0; i < numTraces; i++ ){
+		sources.push_back( globals.micActive? &mic : &globals.player.getVisualPair(i) );
+	}
 	
 	int bufferSize = (exporting==0?2084:256);
-	static float * leftBuffer = new float[bufferSize];
-	static float * rightBuffer = new float[bufferSize];
 
 	// party mode
 	//globals.hue += ofGetMouseX()*100/ofGetWidth();
 	//globals.hue = fmodf(globals.hue,360);
 	
-	MonoSample &left = globals.micActive?(this->left):globals.player.left192;
-	MonoSample &right = globals.micActive?(this->right):globals.player.right192;
-	left.play();
-	right.play();
-	bool isMono = !globals.micActive && globals.player.isMonoFile;
-	
-	if( left.totalLength >= bufferSize && right.totalLength >= bufferSize ){
-		changed = true;
-		/*shapeMesh.addVertex(lastA0Vert);
-		shapeMesh.addColor(lastA0Col);
-		shapeMesh.addVertex(lastA1Vert);
-		shapeMesh.addColor(lastA1Col);*/
-		
-		float uSize = globals.strokeWeight / 1000.0;
-		auto addPt = [&]( ofVec2f p0, ofVec2f p1 ){
-			ofVec2f dir = p1 - p0;
-			float z = dir.length();
-			if (z > EPS) dir /= z;
-			else dir = ofVec2f(1.0, 0.0);
-			
-			dir *= uSize;
-			ofVec2f norm(-dir.y, dir.x);
-			ofVec2f xy(-uSize, -uSize);
-			
-			shapeMesh.addVertex(ofVec3f(p0-dir-norm));
-			shapeMesh.addColor(ofFloatColor(-uSize, -uSize, z));
-			
-			shapeMesh.addVertex(ofVec3f(p0-dir+norm));
-			shapeMesh.addColor(ofFloatColor(-uSize, uSize, z));
-			
-			shapeMesh.addVertex(ofVec3f(p1+dir-norm));
-			shapeMesh.addColor(ofFloatColor(z+uSize, -uSize, z));
-			
-			
-			
-			shapeMesh.addVertex(ofVec3f(p0-dir+norm));
-			shapeMesh.addColor(ofFloatColor(-uSize, uSize, z));
-			
-			shapeMesh.addVertex(ofVec3f(p1+dir-norm));
-			shapeMesh.addColor(ofFloatColor(z+uSize, -uSize, z));
-			
-			shapeMesh.addVertex(ofVec3f(p1+dir+norm));
-			shapeMesh.addColor(ofFloatColor(z+uSize, +uSize, z));
-		};
-		
-		while( left.totalLength >= bufferSize && right.totalLength >= bufferSize ){
-			if(isMono){
-				memset(rightBuffer,0,bufferSize*sizeof(float));
-				right.addTo(rightBuffer, 1, bufferSize);
-				for( int i = 0; i < bufferSize; i++ ){
-					leftBuffer[i] = -1+2*i/(float)bufferSize;
-				}
-			}
-			else{
-				memset(leftBuffer,0,bufferSize*sizeof(float));
-				memset(rightBuffer,0,bufferSize*sizeof(float));
-				left.addTo(leftBuffer, 1, bufferSize);
-				right.addTo(rightBuffer, 1, bufferSize);
-			}
-			
-			if( shapeMesh.getVertices().size() < bufferSize*16 || exporting ){
-				
-				addPt(last,{leftBuffer[0],rightBuffer[0]});
-				last = {leftBuffer[bufferSize-1],rightBuffer[bufferSize-1]};
-				
-				for( int i = 1; i < bufferSize; i++ ){
-					ofVec2f p0(leftBuffer[i-1], rightBuffer[i-1]);
-					ofVec2f p1(leftBuffer[i  ], rightBuffer[i  ]);
-					addPt(p0,p1);
-				}
-				
-			}
-			else{
-				dropped ++;
-			}
-			
-			
-			left.peel(bufferSize);
-			right.peel(bufferSize);
+	meshBuilder.setSources(sources, !globals.micActive && globals.player.isMonoFile);
+	meshBuilder.setBlockSize(bufferSize);
+	// the traces as they end up in the fbo, down to the pixel, so the builder can
+	// merge what lands in the same pixel and skip what's off screen
+	vector<ofMatrix4x4> pixelTransforms;
+	if( fbo.isAllocated() ){
+		ofMatrix4x4 viewMatrix = getViewMatrix();
+		ofMatrix4x4 toPixels =
+			ofMatrix4x4::newScaleMatrix(fbo.getWidth()/2, fbo.getHeight()/2, 1) *
+			ofMatrix4x4::newTranslationMatrix(fbo.getWidth()/2, fbo.getHeight()/2, 0);
+		for( int i = 0; i < numTraces; i++ ){
+			pixelTransforms.push_back(getTraceMatrix(i, numTraces, viewMatrix) * toPixels);
 		}
 	}
+	meshBuilder.setPixelTransforms(pixelTransforms, fbo.getWidth(), fbo.getHeight());
+	// slow frames mean less detail (the builder decimates to fit), fast frames bring it back
+	if( ofGetLastFrameTime() > 1.5/ofGetTargetFrameRate() ) lodScale = MAX(0.125f, lodScale*0.9f);
+	else lodScale = MIN(1.0f, lodScale*1.05f);
+	meshBuilder.setMaxVertices(exporting? 0 : bufferSize*16*lodScale);
+	meshBuilder.setStrokeWeight(globals.strokeWeight / 1000.0);
+	meshBuilder.setSync(exporting != 0);
+	// the cpu renderer when asked for, or when none of the shaders work
+	drawCpu = globals.cpuBeam || (!shader.isLoaded() && !gpuShader.isLoaded());
+	drawGpu = !drawCpu && globals.gpuQuads && gpuShader.isLoaded();
+	meshBuilder.setRawPoints(drawGpu || drawCpu);
+	if( drawGpu || drawCpu ) changed = meshBuilder.updatePoints(tracePoints);
+	else changed = meshBuilder.update(traceMeshes);
 }
 
 ofMatrix4x4 ofApp::getViewMatrix() {
@@ -338,11 +302,35 @@ ofMatrix4x4 ofApp::getViewMatrix() {
 	return viewMatrix * aspectMatrix;
 }
 
+// the full transform for one trace: its own transform, the view, then its tile (if tiled)
+ofMatrix4x4 ofApp::getTraceMatrix( int trace, int numTraces, const ofMatrix4x4 & viewMatrix ){
+	const Globals::Trace & t = globals.traces[trace];
+	ofMatrix4x4 traceMatrix =
+		ofMatrix4x4::newScaleMatrix(t.scale, t.scale, 1) *
+		ofMatrix4x4::newRotationMatrix(t.rotation, 0, 0, 1) *
+		ofMatrix4x4::newTranslationMatrix(t.offsetX, t.offsetY, 0);
+	
+	ofMatrix4x4 tileMatrix; // identity matrix
+	if( globals.tileTraces && numTraces > 1 ){
+		// as square as possible, every tile keeps the aspect ratio
+		int cols = (int)ceilf(sqrtf(numTraces));
+		int rows = (numTraces+cols-1)/cols;
+		float size = 1.0f/MAX(cols,rows);
+		int col = trace%cols;
+		int row = trace/cols;
+		tileMatrix =
+			ofMatrix4x4::newScaleMatrix(size, size, 1) *
+			ofMatrix4x4::newTranslationMatrix(-1+(2*col+1)/(float)cols, 1-(2*row+1)/(float)rows, 0);
+	}
+	
+	return traceMatrix * viewMatrix * tileMatrix;
+}
+
 //--------------------------------------------------------------
 void ofApp::draw(){
 	ofClear(0,255);
 	
-	if( !fbo.isAllocated() || fbo.getWidth() != ofGetWidth() || fbo.getHeight() != ofGetHeight() ){
+	if( !fbo.isAllocated() || fbo.getWidth() != ofGetWidth() || fbo.getHeight() != ofGetHeight() || fboHdr != globals.hdr ){
 		int w = ofGetWidth(); 
 		int h = ofGetHeight();
 		if( exporting ){
@@ -350,22 +338,21 @@ void ofApp::draw(){
 		}
 		else if( w == 0 || h == 0 ){
 			//what is happening???
-			while( globals.player.left192.totalLength > 4096 && globals.player.right192.totalLength > 4096 ){
-				globals.player.left192.peel(4096);
-				globals.player.right192.peel(4096);
-			}
+			// (nothing to do, the mesh builder keeps eating the samples anyway)
 		}
 		else{
 			cout << "allocating framebuffer with " << w << ", " << h << endl; 
-			fbo.allocate(ofGetWidth(), ofGetHeight(),GL_RGBA);
-			fbo.begin();
-			ofClear(0,255);
-			fbo.end();
+			allocateFbo(w, h);
 		}
 	}
 	
-	if( changed && ( globals.player.isPlaying || globals.micActive ) ){
+	if( changed && ( globals.player.isPlaying || globals.micActive ) && drawCpu ){
+		drawBeamCpu();
+	}
+	else if( changed && ( globals.player.isPlaying || globals.micActive ) ){
 		fbo.begin();
+		// afterglow: everything fades by the same factor each frame.
+		// (with hdr that's exact, in 8 bit the faint end rounds to black)
 		ofEnableBlendMode(OF_BLENDMODE_MULTIPLY);
 		ofSetColor( 0, (1-globals.afterglow)*255 );
 		ofFill();
@@ -380,36 +367,65 @@ void ofApp::draw(){
 //		ofDrawLine( 0, -10, 0, 10 );
 		
 		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-		shader.begin();
-		shader.setUniform1f("uSize", globals.strokeWeight / 1000.0);
-		shader.setUniform1f("uIntensity", globals.intensity/sqrtf(globals.timeStretch));
-		shader.setUniformMatrix4f("uMatrix", viewMatrix);
-		shader.setUniform1f("uHue", globals.hue );
+		// the shader premultiplies, see osci.frag
+		glBlendFunc(GL_ONE, GL_ONE);
+		ofShader & traceShader = drawGpu? gpuShader : shader;
+		int numTraces = drawGpu? tracePoints.size() : traceMeshes.size();
+		traceShader.begin();
+		traceShader.setUniform1f("uSize", globals.strokeWeight / 1000.0);
 		ofSetColor(255);
-		shapeMesh.draw();
-		shader.end();
+		if( traceVbos.size() < numTraces ) traceVbos.resize(numTraces);
+		for( int i = 0; i < numTraces; i++ ){
+			const Globals::Trace & trace = globals.traces[i];
+			traceShader.setUniform1f("uIntensity", globals.intensity*trace.intensity/sqrtf(globals.timeStretch));
+			traceShader.setUniformMatrix4f("uMatrix", getTraceMatrix(i, numTraces, viewMatrix));
+			traceShader.setUniform1f("uHue", globals.hue + trace.hue );
+			if( drawGpu ) gpuRenderer.draw(traceShader, i, tracePoints[i]);
+			else traceVbos[i].draw(traceMeshes[i]);
+		}
+		traceShader.end();
 		ofEnableAlphaBlending();
 
 		fbo.end();
 	}
 	
 	ofSetColor(255);
-	fbo.draw(0,0);
+	if( drawCpu && beamTexture.isAllocated() ) beamTexture.draw(0,0);
+	else drawFbo();
 	
 	if( exporting >= 2 ){
 		string filename = ofToDataPath(exportDir + "/" + ofToString(exportFrameNum, 5, '0') + ".png");
 		ofPixels pixels;
-		fbo.readToPixels(pixels);
+		if( drawCpu ){
+			pixels = beamPixels;
+		}
+		else if( fboHdr ){
+			// the png gets what's on screen, not the raw float values
+			if( exportFbo.getWidth() != fbo.getWidth() || exportFbo.getHeight() != fbo.getHeight() ){
+				exportFbo.allocate(fbo.getWidth(), fbo.getHeight(), GL_RGBA);
+			}
+			exportFbo.begin();
+			ofClear(0,255);
+			drawFbo();
+			exportFbo.end();
+			exportFbo.readToPixels(pixels);
+		}
+		else{
+			fbo.readToPixels(pixels);
+		}
 		ofSaveImage(pixels, filename);
 	}
 	
 	if( showInfo || exporting > 0 ){
 		ofSetColor(exporting>0?255:100);
-		ofDrawBitmapString("Dropped: " + ofToString(dropped), 10, 20 );
+		ofDrawBitmapString("Dropped: " + ofToString(meshBuilder.dropped.load()) + " (decimated " + ofToString(meshBuilder.decimated.load()) + ")", 10, 20 );
 		ofDrawBitmapString("FPS:     " + ofToString(ofGetFrameRate(),0), 10, 40 );
 		
-		if( exporting > 0 ){
+		if( exporting == 0 ){
+			ofDrawBitmapString("Buffer:  " + ofToString(globals.player.getQueuedMS()) + "ms / " + ofToString(globals.player.getVisualQueuedMS()) + "ms" + (globals.player.isCached()?" (cached)":""), 10, 60 );
+			ofDrawBitmapString("Underruns: " + ofToString(globals.player.underrunCount.load()), 10, 80 );
+		}
+		else{
 			unsigned long long totalFrames = 1+globals.player.duration*globals.exportFrameRate/1000;
 			int pct = exportFrameNum*100/totalFrames;
 			ofDrawBitmapString("Format:  " + ofToString(globals.exportWidth) + " x " + ofToString(globals.exportHeight) + " @ " + ofToString(globals.exportFrameRate) + "fps (change in " + ofxToReadWriteableDataPath(")settings.txt") + ")", 10, 60);
@@ -426,8 +442,68 @@ void ofApp::draw(){
 	}
 }
 
+void ofApp::allocateFbo( int w, int h ){
+	fboHdr = globals.hdr;
+	if( fboHdr ){
+		// faint beams and long afterglow don't quantize to nothing, and the
+		// afterglow decays without banding. plain 2d texture for the resolve shader.
+		ofFbo::Settings settings;
+		settings.width = w;
+		settings.height = h;
+		settings.internalformat = GL_RGBA16F;
+		settings.textureTarget = GL_TEXTURE_2D;
+		fbo.allocate(settings);
+	}
+	else{
+		fbo.allocate(w, h, GL_RGBA);
+	}
+	fbo.begin();
+	ofClear(0,255);
+	fbo.end();
+}
+
+void ofApp::drawBeamCpu(){
+	// same size as the fbo, so exports get the export size
+	if( beamRenderer.getWidth() != fbo.getWidth() || beamRenderer.getHeight() != fbo.getHeight() ){
+		beamRenderer.allocate(fbo.getWidth(), fbo.getHeight());
+	}
+	
+	beamRenderer.decay(globals.afterglow);
+	beamRenderer.setSize(globals.strokeWeight / 1000.0);
+	ofMatrix4x4 viewMatrix = getViewMatrix();
+	for( int i = 0; i < tracePoints.size(); i++ ){
+		const Globals::Trace & trace = globals.traces[i];
+		beamRenderer.setIntensity(globals.intensity*trace.intensity/sqrtf(globals.timeStretch));
+		beamRenderer.setHue(globals.hue + trace.hue);
+		beamRenderer.draw(tracePoints[i], getTraceMatrix(i, tracePoints.size(), viewMatrix));
+	}
+	
+	beamRenderer.resolve(beamPixels);
+	beamTexture.loadData(beamPixels);
+}
+
+void ofApp::drawFbo(){
+	if( !fboHdr || !resolveShader.isLoaded() ){
+		fbo.draw(0,0);
+		return;
+	}
+	
+	// tone map and glow in one go, this replaces drawing the fbo
+	resolveShader.begin();
+	resolveShader.setUniformTexture("uAccum", fbo.getTexture(), 0);
+	resolveShader.setUniform2f("uPixel", 1.0/fbo.getWidth(), 1.0/fbo.getHeight());
+	resolveShader.setUniform1f("uBloom", globals.blur/255.0);
+	resolveShader.setUniform1f("uRadius", 1 + globals.blur/255.0*8);
+	fbo.draw(0,0);
+	resolveShader.end();
+}
+
 void ofApp::exit(){
 	stopApplication();
+	// it reads from the player, which goes away with the globals
+	meshBuilder.stopThread();
+	meshBuilder.wake();
+	meshBuilder.waitForThread(false);
 	std::exit(0);
 }
 
@@ -516,24 +592,28 @@ void ofApp::windowResized(int w, int h){
 //--------------------------------------------------------------
 void ofApp::audioIn(float * input, int bufferSize, int nChannels){
 	if( globals.micActive ){
-		left.append(input, bufferSize,2);
-		right.append(input+1,bufferSize,2);
+		mic.append(input, bufferSize);
+		meshBuilder.wake();
 	}
 }
 
 void ofApp::audioOut( float * output, int bufferSize, int nChannels ){
-	if( fileToLoad != "" ){
-		globals.timeStretch = 1.0;
-		globals.player.loadSound(fileToLoad);
-		osciView->timeStretchSlider->slider->value = 1.0;
-		setWindowRepresentedFilename(fileToLoad);
-		fileToLoad = "";
-	}
-	
 	memset(output, 0, bufferSize*nChannels);
 	if( globals.player.isLoaded && exporting == 0 && !globals.micActive ){
 		globals.player.audioOut(output, bufferSize, nChannels);
 		AudioAlgo::scale(output, globals.outputVolume, nChannels*bufferSize);
+		// the player has just passed on the matching part of the render stream
+		meshBuilder.wake();
+	}
+}
+
+// called from the player's decoder thread
+void ofApp::soundLoadedEvent( OsciAvAudioPlayer::LoadEventArgs & args ){
+	if( args.success ){
+		soundLoaded = true;
+	}
+	else{
+		ofLogError() << "Could not load " << args.fileName;
 	}
 }
 
@@ -565,7 +645,8 @@ void ofApp::gotMessage(ofMessage msg){
 		globals.micActive = false;
 	}
 	else if( msg.message.substr(0,5) == "load:" ){
-		fileToLoad = msg.message.substr(5);
+		globals.player.clearQueue();
+		globals.player.loadSoundAsync(msg.message.substr(5));
 	}
 }
 
@@ -575,10 +656,33 @@ void ofApp::dragEvent(ofDragInfo dragInfo){
 		cout << *it << endl;
 	}
 	
-	if( dragInfo.files.size() >= 1 ){
-		// this runs on a separate thread.
-		// we have to be careful not to make a mess!
-		fileToLoad = dragInfo.files[0];
+	// folders are played as a playlist, in alphabetical order
+	vector<string> files;
+	for( string & path : dragInfo.files ){
+		ofFile file(path);
+		if( file.isDirectory() ){
+			ofDirectory dir(path);
+			dir.listDir();
+			dir.sort();
+			for( int i = 0; i < dir.size(); i++ ){
+				if( !dir.getFile(i).isDirectory() ){
+					files.push_back(dir.getPath(i));
+				}
+			}
+		}
+		else{
+			files.push_back(path);
+		}
+	}
+	
+	if( files.size() >= 1 ){
+		// this runs on a separate thread, the player takes care of that.
+		// the first file replaces the current one, the player opens the others itself when it gets there
+		globals.player.clearQueue();
+		for( int i = 1; i < files.size(); i++ ){
+			globals.player.queueSound(files[i]);
+		}
+		globals.player.loadSoundAsync(files[0]);
 	}
 	
 }
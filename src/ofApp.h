@@ -8,6 +8,11 @@
 #include "ui/ConfigView.h"
 #include "ui/OsciView.h"
 #include "util/Audio.h"
+#include "util/OsciAvAudioPlayer.h"
+#include "util/TraceMeshBuilder.h"
+#include "util/GpuTraceRenderer.h"
+#include "util/StreamingVbo.h"
+#include "util/BeamRenderer.h"
 #include "ofxAvAudioPlayer.h"
 
 class ofApp : public ofBaseApp{
@@ -33,8 +38,16 @@ class ofApp : public ofBaseApp{
 		
 		void audioIn(float * input, int bufferSize, int nChannels);
 		void audioOut( float * output, int bufferSize, int nChannels ); 
+		void soundLoadedEvent( OsciAvAudioPlayer::LoadEventArgs & args );
 
 		ofMatrix4x4 getViewMatrix();
+		ofMatrix4x4 getTraceMatrix( int trace, int numTraces, const ofMatrix4x4 & viewMatrix );
+		// (re)allocates and clears the fbo, as float or 8 bit depending on globals.hdr
+		void allocateFbo( int w, int h );
+		// draws the fbo (tone mapped, with hdr)
+		void drawFbo();
+		// the cpu version of the frame, into beamPixels/beamTexture
+		void drawBeamCpu();
 	
 		ofSoundStream soundStream;
 		ofSoundStream micStream;
@@ -43,17 +56,40 @@ class ofApp : public ofBaseApp{
 		ConfigView * configView;
 		OsciView * osciView;
 		ofPath path;
-		ofMesh shapeMesh;
+		// one trace per channel pair of the file (just one for stereo files and the mic)
+		vector<ofMesh> traceMeshes;
+		// where the meshes are drawn from
+		vector<StreamingVbo> traceVbos;
+		// the same, as raw points for the gpu path (see GpuTraceRenderer)
+		vector<vector<ofVec3f>> tracePoints;
+		TraceMeshBuilder meshBuilder;
+		GpuTraceRenderer gpuRenderer;
 		ofFbo fbo;
+		// true if fbo is a float buffer that needs the resolve shader
+		bool fboHdr;
+		// the resolved image, for exporting with hdr
+		ofFbo exportFbo;
+		ofShader resolveShader;
+		ShaderLoader resolveShaderLoader;
 		ofShader shader;
 		ShaderLoader shaderLoader;
+		ofShader gpuShader;
+		ShaderLoader gpuShaderLoader;
+		// true if this frame's traces are in tracePoints instead of traceMeshes
+		bool drawGpu;
+		// true if they're drawn by beamRenderer instead (also from tracePoints)
+		bool drawCpu;
+		BeamRenderer beamRenderer;
+		ofPixels beamPixels;
+		ofTexture beamTexture;
+		// scales the vertex budget, shrinks when frames take too long
+		float lodScale;
 	
-		MonoSample left;
-		MonoSample right;
+		// filled from the mic callback, lock-free
+		StereoSample mic{1<<18};
 	
 		bool changed;
 		bool clearFbos;
-		int dropped; 
 		bool showInfo; 
 	
 		int exporting;
@@ -62,7 +98,8 @@ class ofApp : public ofBaseApp{
 	
 	
 		unsigned long long lastMouseMoved;
-		string fileToLoad;
-	
-		ofVec2f last;
+		// set by the player's decoder thread once loadSoundAsync() is done
+		std::atomic<bool> soundLoaded;
+		// file shown in the window title
+		string shownFileName;
 };
@@ -149,17 +149,18 @@ void OsciView::layout(){
 	mui::L(strokeWeightLabel).below(scaleLabel).alignRightEdgeTo(scaleLabel);
 	mui::L(strokeWeightSlider).rightOf(strokeWeightLabel,5).stretchToRightEdgeOf(this,10);
 	
-	/*mui::L(blurLabel).below(strokeWeightLabel).alignRightEdgeTo(strokeWeightLabel);
+	// blur is the glow of the hdr resolve, there's nothing to blur without it
+	mui::L(blurLabel).below(strokeWeightLabel).alignRightEdgeTo(strokeWeightLabel);
 	mui::L(blurSlider).rightOf(blurLabel,5).stretchToRightEdgeOf(this,10);
+	blurLabel->visible = globals.hdr;
+	blurSlider->visible = globals.hdr;
 	
-	mui::L(numPtsLabel).below(blurLabel).alignRightEdgeTo(blurLabel);
+	/*mui::L(numPtsLabel).below(blurLabel).alignRightEdgeTo(blurLabel);
 	mui::L(numPtsSlider).rightOf(numPtsLabel,5).stretchToRightEdgeOf(this,10);*/
-	blurLabel->visible = false;
-	blurSlider->visible = false;
 	numPtsLabel->visible = false;
 	numPtsSlider->visible = false;
 	
-	mui::L(hueLabel).below(strokeWeightLabel).alignRightEdgeTo(strokeWeightLabel);
+	mui::L(hueLabel).below(globals.hdr? blurLabel : strokeWeightLabel).alignRightEdgeTo(strokeWeightLabel);
 	mui::L(hueSlider).rightOf(hueLabel,5).stretchToRightEdgeOf(this,10);
 	
 	mui::L(intensityLabel).below(hueLabel).alignRightEdgeTo(hueLabel);
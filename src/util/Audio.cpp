@@ -14,11 +14,456 @@ using namespace std;
 #define MIN(a,b) (a<b?a:b)
 #endif
 
-MonoSample::MonoSample(){
+#ifndef MAX
+#define MAX(a,b) (a>b?a:b)
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AUDIO_ALGO_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AUDIO_ALGO_AVX2
+#else
+#define AUDIO_ALGO_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define AUDIO_ALGO_NEON 1
+#include <arm_neon.h>
+#endif
+
+
+//
+// AudioAlgo kernels
+//
+// every kernel handles as much as possible with vectors, then finishes the tail with scalar code.
+//
+
+namespace{
+	float mean_abs_scalar( const float * buffer, int N ){
+		float result = 0;
+		for( int i = 0; i < N; i++ ){
+			result += fabsf( buffer[i] );
+		}
+		return N > 0? result/N : 0;
+	}
+	
+	float max_abs_scalar( const float * buffer, int N ){
+		float result = 0;
+		for( int i = 0; i < N; i++ ){
+			result = MAX( fabsf( buffer[i] ), result );
+		}
+		return result;
+	}
+	
+	void copy_scalar( float * destination, int destStride, const float * source, int sourceStride, int N ){
+		if( destStride == 1 && sourceStride == 1 ){
+			memcpy( destination, source, N*sizeof(float) );
+			return;
+		}
+		for( int i = 0; i < N; i++ ){
+			destination[i*destStride] = source[i*sourceStride];
+		}
+	}
+	
+	void scale_scalar( float * destination, float factor, int N ){
+		for( int i = 0; i < N; i++ ){
+			destination[i] *= factor;
+		}
+	}
+	
+	void deinterleave_scalar( float * left, float * right, const float * source, int N ){
+		for( int i = 0; i < N; i++ ){
+			left[i] = source[2*i];
+			right[i] = source[2*i+1];
+		}
+	}
+	
+	void int16_to_float_scalar( float * destination, const int16_t * source, int N ){
+		for( int i = 0; i < N; i++ ){
+			destination[i] = source[i]*(1.0f/32768);
+		}
+	}
+	
+	void int24_to_float_scalar( float * destination, const uint8_t * source, int N ){
+		for( int i = 0; i < N; i++ ){
+			// into the top of an int32, then shift back down to get the sign right
+			int32_t v = (int32_t)(((uint32_t)source[3*i]<<8) | ((uint32_t)source[3*i+1]<<16) | ((uint32_t)source[3*i+2]<<24));
+			destination[i] = (v>>8)*(1.0f/8388608);
+		}
+	}
+	
+#ifdef AUDIO_ALGO_X86
+	float hsum_sse2( __m128 v ){
+		v = _mm_add_ps( v, _mm_movehl_ps( v, v ) );
+		v = _mm_add_ss( v, _mm_shuffle_ps( v, v, 1 ) );
+		return _mm_cvtss_f32( v );
+	}
+	
+	float hmax_sse2( __m128 v ){
+		v = _mm_max_ps( v, _mm_movehl_ps( v, v ) );
+		v = _mm_max_ss( v, _mm_shuffle_ps( v, v, 1 ) );
+		return _mm_cvtss_f32( v );
+	}
+	
+	float mean_abs_sse2( const float * buffer, int N ){
+		const __m128 mask = _mm_castsi128_ps( _mm_set1_epi32( 0x7fffffff ) );
+		__m128 sum = _mm_setzero_ps();
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			sum = _mm_add_ps( sum, _mm_and_ps( _mm_loadu_ps( buffer+i ), mask ) );
+		}
+		float result = hsum_sse2( sum );
+		for( ; i < N; i++ ){
+			result += fabsf( buffer[i] );
+		}
+		return N > 0? result/N : 0;
+	}
+	
+	float max_abs_sse2( const float * buffer, int N ){
+		const __m128 mask = _mm_castsi128_ps( _mm_set1_epi32( 0x7fffffff ) );
+		__m128 max = _mm_setzero_ps();
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			max = _mm_max_ps( max, _mm_and_ps( _mm_loadu_ps( buffer+i ), mask ) );
+		}
+		float result = hmax_sse2( max );
+		for( ; i < N; i++ ){
+			result = MAX( fabsf( buffer[i] ), result );
+		}
+		return result;
+	}
+	
+	void copy_sse2( float * destination, int destStride, const float * source, int sourceStride, int N ){
+		if( destStride != 1 || sourceStride != 2 ){
+			copy_scalar( destination, destStride, source, sourceStride, N );
+			return;
+		}
+		// picking one channel out of a stereo buffer
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			__m128 a = _mm_loadu_ps( source + 2*i );
+			__m128 b = _mm_loadu_ps( source + 2*i + 4 );
+			_mm_storeu_ps( destination+i, _mm_shuffle_ps( a, b, _MM_SHUFFLE(2,0,2,0) ) );
+		}
+		for( ; i < N; i++ ){
+			destination[i] = source[2*i];
+		}
+	}
+	
+	void scale_sse2( float * destination, float factor, int N ){
+		const __m128 f = _mm_set1_ps( factor );
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			_mm_storeu_ps( destination+i, _mm_mul_ps( _mm_loadu_ps( destination+i ), f ) );
+		}
+		for( ; i < N; i++ ){
+			destination[i] *= factor;
+		}
+	}
+	
+	void deinterleave_sse2( float * left, float * right, const float * source, int N ){
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			__m128 a = _mm_loadu_ps( source + 2*i );
+			__m128 b = _mm_loadu_ps( source + 2*i + 4 );
+			_mm_storeu_ps( left+i, _mm_shuffle_ps( a, b, _MM_SHUFFLE(2,0,2,0) ) );
+			_mm_storeu_ps( right+i, _mm_shuffle_ps( a, b, _MM_SHUFFLE(3,1,3,1) ) );
+		}
+		deinterleave_scalar( left+i, right+i, source+2*i, N-i );
+	}
+	
+	void int16_to_float_sse2( float * destination, const int16_t * source, int N ){
+		const __m128 f = _mm_set1_ps( 1.0f/32768 );
+		int i = 0;
+		for( ; i + 8 <= N; i += 8 ){
+			__m128i v = _mm_loadu_si128( (const __m128i*)(source+i) );
+			// each sample into the top half of a 32 bit lane, the shift extends the sign
+			__m128i lo = _mm_srai_epi32( _mm_unpacklo_epi16( v, v ), 16 );
+			__m128i hi = _mm_srai_epi32( _mm_unpackhi_epi16( v, v ), 16 );
+			_mm_storeu_ps( destination+i, _mm_mul_ps( _mm_cvtepi32_ps( lo ), f ) );
+			_mm_storeu_ps( destination+i+4, _mm_mul_ps( _mm_cvtepi32_ps( hi ), f ) );
+		}
+		int16_to_float_scalar( destination+i, source+i, N-i );
+	}
+	
+	AUDIO_ALGO_AVX2 float mean_abs_avx2( const float * buffer, int N ){
+		const __m256 mask = _mm256_castsi256_ps( _mm256_set1_epi32( 0x7fffffff ) );
+		__m256 sum = _mm256_setzero_ps();
+		int i = 0;
+		for( ; i + 8 <= N; i += 8 ){
+			sum = _mm256_add_ps( sum, _mm256_and_ps( _mm256_loadu_ps( buffer+i ), mask ) );
+		}
+		float result = hsum_sse2( _mm_add_ps( _mm256_castps256_ps128( sum ), _mm256_extractf128_ps( sum, 1 ) ) );
+		for( ; i < N; i++ ){
+			result += fabsf( buffer[i] );
+		}
+		return N > 0? result/N : 0;
+	}
+	
+	AUDIO_ALGO_AVX2 float max_abs_avx2( const float * buffer, int N ){
+		const __m256 mask = _mm256_castsi256_ps( _mm256_set1_epi32( 0x7fffffff ) );
+		__m256 max = _mm256_setzero_ps();
+		int i = 0;
+		for( ; i + 8 <= N; i += 8 ){
+			max = _mm256_max_ps( max, _mm256_and_ps( _mm256_loadu_ps( buffer+i ), mask ) );
+		}
+		float result = hmax_sse2( _mm_max_ps( _mm256_castps256_ps128( max ), _mm256_extractf128_ps( max, 1 ) ) );
+		for( ; i < N; i++ ){
+			result = MAX( fabsf( buffer[i] ), result );
+		}
+		return result;
+	}
+	
+	// shuffle works within the 128bit lanes, so we end up with a0 a2 b0 b2 | a4 a6 b4 b6 and fix the order afterwards
+	AUDIO_ALGO_AVX2 __m256 even_avx2( __m256 a, __m256 b ){
+		__m256 v = _mm256_shuffle_ps( a, b, _MM_SHUFFLE(2,0,2,0) );
+		return _mm256_castpd_ps( _mm256_permute4x64_pd( _mm256_castps_pd( v ), _MM_SHUFFLE(3,1,2,0) ) );
+	}
+	
+	AUDIO_ALGO_AVX2 __m256 odd_avx2( __m256 a, __m256 b ){
+		__m256 v = _mm256_shuffle_ps( a, b, _MM_SHUFFLE(3,1,3,1) );
+		return _mm256_castpd_ps( _mm256_permute4x64_pd( _mm256_castps_pd( v ), _MM_SHUFFLE(3,1,2,0) ) );
+	}
+	
+	AUDIO_ALGO_AVX2 void copy_avx2( float * destination, int destStride, const float * source, int sourceStride, int N ){
+		if( destStride != 1 || sourceStride != 2 ){
+			copy_scalar( destination, destStride, source, sourceStride, N );
+			return;
+		}
+		int i = 0;
+		for( ; i + 8 <= N; i += 8 ){
+			__m256 a = _mm256_loadu_ps( source + 2*i );
+			__m256 b = _mm256_loadu_ps( source + 2*i + 8 );
+			_mm256_storeu_ps( destination+i, even_avx2( a, b ) );
+		}
+		for( ; i < N; i++ ){
+			destination[i] = source[2*i];
+		}
+	}
+	
+	AUDIO_ALGO_AVX2 void scale_avx2( float * destination, float factor, int N ){
+		const __m256 f = _mm256_set1_ps( factor );
+		int i = 0;
+		for( ; i + 8 <= N; i += 8 ){
+			_mm256_storeu_ps( destination+i, _mm256_mul_ps( _mm256_loadu_ps( destination+i ), f ) );
+		}
+		for( ; i < N; i++ ){
+			destination[i] *= factor;
+		}
+	}
+	
+	AUDIO_ALGO_AVX2 void deinterleave_avx2( float * left, float * right, const float * source, int N ){
+		int i = 0;
+		for( ; i + 8 <= N; i += 8 ){
+			__m256 a = _mm256_loadu_ps( source + 2*i );
+			__m256 b = _mm256_loadu_ps( source + 2*i + 8 );
+			_mm256_storeu_ps( left+i, even_avx2( a, b ) );
+			_mm256_storeu_ps( right+i, odd_avx2( a, b ) );
+		}
+		deinterleave_scalar( left+i, right+i, source+2*i, N-i );
+	}
+	
+	AUDIO_ALGO_AVX2 void int16_to_float_avx2( float * destination, const int16_t * source, int N ){
+		const __m256 f = _mm256_set1_ps( 1.0f/32768 );
+		int i = 0;
+		for( ; i + 8 <= N; i += 8 ){
+			__m256i v = _mm256_cvtepi16_epi32( _mm_loadu_si128( (const __m128i*)(source+i) ) );
+			_mm256_storeu_ps( destination+i, _mm256_mul_ps( _mm256_cvtepi32_ps( v ), f ) );
+		}
+		int16_to_float_scalar( destination+i, source+i, N-i );
+	}
+	
+	AUDIO_ALGO_AVX2 void int24_to_float_avx2( float * destination, const uint8_t * source, int N ){
+		const __m256 f = _mm256_set1_ps( 1.0f/8388608 );
+		// four samples per 128bit lane, each moved into the top three bytes of its 32 bit slot
+		const __m256i shuffle = _mm256_setr_epi8(
+			-1,0,1,2, -1,3,4,5, -1,6,7,8, -1,9,10,11,
+			-1,0,1,2, -1,3,4,5, -1,6,7,8, -1,9,10,11 );
+		int i = 0;
+		// the loads are 16 bytes wide but only use 12, so stay clear of the end
+		for( ; i + 10 <= N; i += 8 ){
+			__m128i a = _mm_loadu_si128( (const __m128i*)(source+3*i) );
+			__m128i b = _mm_loadu_si128( (const __m128i*)(source+3*i+12) );
+			__m256i v = _mm256_inserti128_si256( _mm256_castsi128_si256( a ), b, 1 );
+			v = _mm256_srai_epi32( _mm256_shuffle_epi8( v, shuffle ), 8 );
+			_mm256_storeu_ps( destination+i, _mm256_mul_ps( _mm256_cvtepi32_ps( v ), f ) );
+		}
+		int24_to_float_scalar( destination+i, source+3*i, N-i );
+	}
+	
+	bool cpu_has_avx2(){
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid( info, 0 );
+		if( info[0] < 7 ) return false;
+		__cpuid( info, 1 );
+		// avx + osxsave, and the os actually saves the ymm registers
+		if( (info[2] & (1<<27)) == 0 || (info[2] & (1<<28)) == 0 ) return false;
+		if( (_xgetbv(0) & 6) != 6 ) return false;
+		__cpuidex( info, 7, 0 );
+		return (info[1] & (1<<5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports( "avx2" );
+#endif
+	}
+#endif
+	
+#ifdef AUDIO_ALGO_NEON
+	float mean_abs_neon( const float * buffer, int N ){
+		float32x4_t sum = vdupq_n_f32( 0 );
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			sum = vaddq_f32( sum, vabsq_f32( vld1q_f32( buffer+i ) ) );
+		}
+		float lanes[4];
+		vst1q_f32( lanes, sum );
+		float result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+		for( ; i < N; i++ ){
+			result += fabsf( buffer[i] );
+		}
+		return N > 0? result/N : 0;
+	}
+	
+	float max_abs_neon( const float * buffer, int N ){
+		float32x4_t max = vdupq_n_f32( 0 );
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			max = vmaxq_f32( max, vabsq_f32( vld1q_f32( buffer+i ) ) );
+		}
+		float lanes[4];
+		vst1q_f32( lanes, max );
+		float result = MAX( MAX( lanes[0], lanes[1] ), MAX( lanes[2], lanes[3] ) );
+		for( ; i < N; i++ ){
+			result = MAX( fabsf( buffer[i] ), result );
+		}
+		return result;
+	}
+	
+	void copy_neon( float * destination, int destStride, const float * source, int sourceStride, int N ){
+		if( destStride != 1 || sourceStride != 2 ){
+			copy_scalar( destination, destStride, source, sourceStride, N );
+			return;
+		}
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			vst1q_f32( destination+i, vld2q_f32( source + 2*i ).val[0] );
+		}
+		for( ; i < N; i++ ){
+			destination[i] = source[2*i];
+		}
+	}
+	
+	void scale_neon( float * destination, float factor, int N ){
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			vst1q_f32( destination+i, vmulq_n_f32( vld1q_f32( destination+i ), factor ) );
+		}
+		for( ; i < N; i++ ){
+			destination[i] *= factor;
+		}
+	}
+	
+	void deinterleave_neon( float * left, float * right, const float * source, int N ){
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			float32x4x2_t lr = vld2q_f32( source + 2*i );
+			vst1q_f32( left+i, lr.val[0] );
+			vst1q_f32( right+i, lr.val[1] );
+		}
+		deinterleave_scalar( left+i, right+i, source+2*i, N-i );
+	}
+	
+	void int16_to_float_neon( float * destination, const int16_t * source, int N ){
+		int i = 0;
+		for( ; i + 8 <= N; i += 8 ){
+			int16x8_t v = vld1q_s16( source+i );
+			// fixed point conversion with 15 fractional bits does the scaling for free
+			vst1q_f32( destination+i, vcvtq_n_f32_s32( vmovl_s16( vget_low_s16( v ) ), 15 ) );
+			vst1q_f32( destination+i+4, vcvtq_n_f32_s32( vmovl_s16( vget_high_s16( v ) ), 15 ) );
+		}
+		int16_to_float_scalar( destination+i, source+i, N-i );
+	}
+	
+	void int24_to_float_neon( float * destination, const uint8_t * source, int N ){
+		int i = 0;
+		for( ; i + 16 <= N; i += 16 ){
+			// splits the bytes into low, middle and high planes
+			uint8x16x3_t b = vld3q_u8( source+3*i );
+			uint8x8_t lo[2] = { vget_low_u8( b.val[0] ), vget_high_u8( b.val[0] ) };
+			uint8x8_t mid[2] = { vget_low_u8( b.val[1] ), vget_high_u8( b.val[1] ) };
+			uint8x8_t hi[2] = { vget_low_u8( b.val[2] ), vget_high_u8( b.val[2] ) };
+			for( int k = 0; k < 2; k++ ){
+				uint16x8_t low16 = vorrq_u16( vshll_n_u8( mid[k], 8 ), vmovl_u8( lo[k] ) );
+				int16x8_t high16 = vmovl_s8( vreinterpret_s8_u8( hi[k] ) );
+				int32x4_t v0 = vorrq_s32( vshlq_n_s32( vmovl_s16( vget_low_s16( high16 ) ), 16 ), vreinterpretq_s32_u32( vmovl_u16( vget_low_u16( low16 ) ) ) );
+				int32x4_t v1 = vorrq_s32( vshlq_n_s32( vmovl_s16( vget_high_s16( high16 ) ), 16 ), vreinterpretq_s32_u32( vmovl_u16( vget_high_u16( low16 ) ) ) );
+				vst1q_f32( destination+i+8*k, vcvtq_n_f32_s32( v0, 23 ) );
+				vst1q_f32( destination+i+8*k+4, vcvtq_n_f32_s32( v1, 23 ) );
+			}
+		}
+		int24_to_float_scalar( destination+i, source+3*i, N-i );
+	}
+#endif
+	
+	AudioAlgo::Kernels pick_kernels(){
+#ifdef AUDIO_ALGO_X86
+		if( cpu_has_avx2() ){
+			return { "avx2", mean_abs_avx2, max_abs_avx2, copy_avx2, scale_avx2, deinterleave_avx2, int16_to_float_avx2, int24_to_float_avx2 };
+		}
+		// sse2 has no byte shuffle, 24 bit samples stay scalar there
+		return { "sse2", mean_abs_sse2, max_abs_sse2, copy_sse2, scale_sse2, deinterleave_sse2, int16_to_float_sse2, int24_to_float_scalar };
+#elif defined(AUDIO_ALGO_NEON)
+		return { "neon", mean_abs_neon, max_abs_neon, copy_neon, scale_neon, deinterleave_neon, int16_to_float_neon, int24_to_float_neon };
+#else
+		return AudioAlgo::scalarKernels();
+#endif
+	}
+}
+
+const AudioAlgo::Kernels & AudioAlgo::kernels(){
+	static const Kernels k = pick_kernels();
+	return k;
+}
+
+const AudioAlgo::Kernels & AudioAlgo::scalarKernels(){
+	static const Kernels k = { "scalar", mean_abs_scalar, max_abs_scalar, copy_scalar, scale_scalar, deinterleave_scalar, int16_to_float_scalar, int24_to_float_scalar };
+	return k;
+}
+
+bool AudioAlgo::cpuHasAvx2(){
+#ifdef AUDIO_ALGO_X86
+	static const bool avx2 = cpu_has_avx2();
+	return avx2;
+#else
+	return false;
+#endif
+}
+
+
+MonoSample::MonoSample() : MonoSample(0){
+}
+
+MonoSample::MonoSample( int ringCapacity ){
+	playing = false;
 	playbackIndex = 0; 
 	totalLength = 0; 
+	cursorChunk = 0;
+	cursorStart = 0;
+	headOffset = 0;
 	velocity = 1;
 	loop = false;
+	droppedSamples = 0;
+	
+	ringData = NULL;
+	if( ringCapacity > 0 ){
+		int capacity = ring.setup(ringCapacity);
+		ringData = new float[capacity];
+		memset( ringData, 0, capacity*sizeof(float) );
+	}
 }
 
 
@@ -28,20 +473,61 @@ MonoSample::~MonoSample(){
         bufferData.pop_back();
 		bufferSizes.pop_back();
     }
+	delete[] ringData;
 }
 
 void MonoSample::play(){
+	if( ringData ){
+		playing = true;
+		return;
+	}
+	
 	lock.lock();
 	playing = true; 
 	lock.unlock();
 }
 
 void MonoSample::skip( int numSamples ){
+	if( ringData ){
+		_ringDiscard();
+		_skip(numSamples);
+		return;
+	}
+	
 	lock.lock(); 
 	_skip(numSamples);
 	lock.unlock(); 
 }
 
+// moves the cursor to the chunk containing playbackIndex.
+// playback mostly moves forward, so this is O(1) amortized.
+// cursorStart counts from the beginning of the first chunk, including the headOffset samples that were already peeled.
+void MonoSample::_seekCursor(){
+	int index = playbackIndex + headOffset;
+	if( cursorChunk >= (int)bufferSizes.size() || index < cursorStart ){
+		cursorChunk = 0;
+		cursorStart = 0;
+	}
+	
+	while( cursorStart + bufferSizes[cursorChunk] <= index ){
+		cursorStart += bufferSizes[cursorChunk];
+		cursorChunk ++;
+	}
+}
+
+// the first chunk was removed from the storage (the first numSamples were still unread)
+void MonoSample::_headRemoved( int numSamples, int chunkSize ){
+	if( cursorChunk > 0 ){
+		cursorChunk --;
+		cursorStart -= chunkSize;
+	}
+	else{
+		cursorStart = 0;
+	}
+	headOffset = 0;
+	_skip(-numSamples);
+}
+
 void MonoSample::_skip( int numSamples ){
 	if( totalLength == 0 ){
 		playbackIndex = 0;
@@ -53,6 +539,11 @@ void MonoSample::_skip( int numSamples ){
 }
 
 void MonoSample::append(float * buffer, int N){
+	if( ringData ){
+		_ringAppend(buffer, N, 1);
+		return;
+	}
+	
 	float * data = new float[N];
 	memcpy( data, buffer, sizeof(float)*N );
 	lock.lock();
@@ -63,6 +554,11 @@ void MonoSample::append(float * buffer, int N){
 }
 
 void MonoSample::append(float * buffer, int N, int srcStride){
+	if( ringData ){
+		_ringAppend(buffer, N, srcStride);
+		return;
+	}
+	
 	float * data = new float[N];
 	AudioAlgo::copy(data, 1, buffer, srcStride, N);
 	lock.lock();
@@ -73,13 +569,20 @@ void MonoSample::append(float * buffer, int N, int srcStride){
 }
 
 void MonoSample::removeHead(){
+	if( ringData ){
+		peel(totalLength);
+		return;
+	}
+	
 	lock.lock();
 	if( bufferData.size() > 0 ){
 		float * first = bufferData[0];
-		totalLength -= bufferSizes[0];
-		_skip(-bufferSizes[0]);
-		bufferData.erase(bufferData.begin());
-		bufferSizes.erase(bufferSizes.begin());
+		int chunkSize = bufferSizes[0];
+		int numSamples = chunkSize - headOffset;
+		totalLength -= numSamples;
+		bufferData.pop_front();
+		bufferSizes.pop_front();
+		_headRemoved(numSamples, chunkSize);
 		
 		delete[] first;
 	}
@@ -87,6 +590,14 @@ void MonoSample::removeHead(){
 }
 
 void MonoSample::clear(){
+	if( ringData ){
+		// we might not be the consumer, so only leave a note where the data ends.
+		// playback stops right away, the consumer resets playbackIndex when it drops the data.
+		ring.requestDiscard();
+		playing = false;
+		return;
+	}
+	
 	lock.lock();
 	while( bufferData.size() > 0 ){
 		removeHead();
@@ -97,26 +608,32 @@ void MonoSample::clear(){
 }
 
 void MonoSample::peel(int N){
+	if( ringData ){
+		_ringDiscard();
+		unsigned int readPos;
+		int available = ring.available(readPos);
+		N = MIN(N,available);
+		if( N > 0 ){
+			ring.release(readPos, N);
+			totalLength -= N;
+			playbackIndex = MAX(0,playbackIndex-N);
+		}
+		return;
+	}
+	
 	lock.lock();
-	N = MIN(N,totalLength); 
-	int NN = N;
+	N = MIN(N,(int)totalLength); 
 	while( N > 0 && totalLength > 0 ){
-		if( bufferSizes[0] <= N ){
-			N -= bufferSizes[0]; 
+		int available = bufferSizes[0] - headOffset;
+		if( available <= N ){
+			N -= available; 
 			removeHead();
 		}
 		else{
-			// todo: this has some problems it seems. 
-			int remaining = bufferSizes[0]-N;
-			float * buffer = new float[remaining];
-			memcpy(buffer, &bufferData[0][N], remaining*sizeof(float));
-			float * old = bufferData[0];
-			bufferData[0] = buffer;
-			bufferSizes[0] = remaining;
-			delete[] old;
-			
-			_skip(-N);
+			// only move the read offset, the chunk is deleted once it's used up
+			headOffset += N;
 			totalLength -= N;
+			_skip(-N);
 			break; 
 		}
 	}
@@ -125,15 +642,25 @@ void MonoSample::peel(int N){
 }
 
 float * MonoSample::peelHead( int &numSamples ){
+	if( ringData ){
+		numSamples = 0;
+		return NULL;
+	}
+	
 	lock.lock();
 	float * result = NULL;
 	
 	if( bufferSizes.size() > 0 ){
-		numSamples = bufferSizes[0];
+		int chunkSize = bufferSizes[0];
+		numSamples = chunkSize - headOffset;
 		result = bufferData[0];
-		bufferData.erase(bufferData.begin());
-		bufferSizes.erase(bufferSizes.begin());
-		_skip(-numSamples);
+		if( headOffset > 0 ){
+			memmove(result, result+headOffset, numSamples*sizeof(float));
+		}
+		totalLength -= numSamples;
+		bufferData.pop_front();
+		bufferSizes.pop_front();
+		_headRemoved(numSamples, chunkSize);
 	}
 	else{
 		numSamples = 0;
@@ -143,12 +670,63 @@ float * MonoSample::peelHead( int &numSamples ){
 	return result;
 }
 
+MonoSample::Span MonoSample::peekSpan( int N ){
+	Span span;
+	span.data[0] = span.data[1] = NULL;
+	span.length[0] = span.length[1] = 0;
+	
+	if( ringData ){
+		_ringDiscard();
+		unsigned int readPos;
+		int available = ring.available(readPos);
+		N = MIN(N, available);
+		span.data[0] = ringData + (readPos&ring.mask);
+		span.length[0] = ring.firstPart(readPos, N);
+		span.data[1] = ringData;
+		span.length[1] = N - span.length[0];
+		return span;
+	}
+	
+	lock.lock();
+	for( int i = 0; i < 2 && i < (int)bufferSizes.size() && N > 0; i++ ){
+		int offset = i == 0? headOffset : 0;
+		span.data[i] = bufferData[i] + offset;
+		span.length[i] = MIN(N, bufferSizes[i] - offset);
+		N -= span.length[i];
+	}
+	lock.unlock();
+	
+	return span;
+}
+
+void MonoSample::consume( int N ){
+	peel( N );
+}
+
 float * MonoSample::peekHead( int &numSamples, int bufferNum ){
+	if( ringData ){
+		_ringDiscard();
+		unsigned int readPos;
+		int available = ring.available(readPos);
+		int first = ring.firstPart(readPos, available);
+		if( bufferNum == 0 && first > 0 ){
+			numSamples = first;
+			return ringData + (readPos&ring.mask);
+		}
+		else if( bufferNum == 1 && available > first ){
+			numSamples = available - first;
+			return ringData;
+		}
+		numSamples = 0;
+		return NULL;
+	}
+	
 	lock.lock();
 	float * result = NULL;
-	if( bufferSizes.size() > bufferNum ){
-		numSamples = bufferSizes[bufferNum];
-		result = bufferData[bufferNum];
+	if( (int)bufferSizes.size() > bufferNum ){
+		int offset = bufferNum == 0? headOffset : 0;
+		numSamples = bufferSizes[bufferNum] - offset;
+		result = bufferData[bufferNum] + offset;
 	}
 	else{
 		numSamples = 0;
@@ -166,50 +744,324 @@ int MonoSample::addTo(float *output, int outStride, int N ){
 		return 0;
 	}
 	
+	if( ringData ){
+		_ringDiscard();
+		unsigned int readPos;
+		int available = ring.available(readPos);
+		int copied = 0;
+		
+		while( copied < N ){
+			if( playbackIndex >= available ){
+				playbackIndex = 0;
+				if( loop == false || available == 0 ){
+					playing = false;
+					return copied;
+				}
+			}
+			
+			unsigned int pos = readPos+playbackIndex;
+			int copyN = ring.firstPart( pos, MIN( N - copied, available - playbackIndex ) );
+			
+			float * source = ringData + (pos&ring.mask);
+			for( int j = 0; j < copyN; j++ ){
+				output[outStride*copied] += source[j]*velocity;
+				copied ++;
+			}
+			
+			playbackIndex += copyN;
+		}
+		
+		return copied;
+	}
+	
 	lock.lock();
-	//TODO: make this faster!
-	// find the right index...
 	int copied = 0;
 	
 	while( copied < N ){
-		// find the right buffer...
-		int len = 0;
-		for( int i = 0; i < bufferData.size(); i++ ){
-			int sourceN = bufferSizes[i];
-			
-			if( len + sourceN > playbackIndex ){
-				// good, we have something to copy ...
-				float * source = bufferData[i];
-				int  sourceStart = playbackIndex - len;
-				int copyN = MIN( sourceN, N - copied );
-				
-				for( int j = sourceStart; j < copyN; j++ ){
-					output[outStride*copied] += source[j]*velocity;
-					copied ++;
-				}
-				
-				playbackIndex += copyN;
-				if( copied >= N ){
-					// done for today!
-					lock.unlock();
-					return copied;
-				}
+		if( playbackIndex >= totalLength ){
+			playbackIndex = 0;
+			if( loop == false || totalLength == 0 ){
+				playing = false;
+				break;
 			}
-			len += sourceN;
 		}
 		
-		if( playbackIndex >= len ){
-			if( loop == true && totalLength > 0 ){
-				playbackIndex = 0;
-			}
-			else{
-				playbackIndex = 0;
-				playing = false; 
-				lock.unlock();
-				return copied;
-			}
+		// find the right buffer...
+		_seekCursor();
+		float * source = bufferData[cursorChunk];
+		int sourceStart = playbackIndex + headOffset - cursorStart;
+		int copyN = MIN( bufferSizes[cursorChunk] - sourceStart, N - copied );
+		
+		for( int j = 0; j < copyN; j++ ){
+			output[outStride*copied] += source[sourceStart+j]*velocity;
+			copied ++;
 		}
+		
+		playbackIndex += copyN;
 	}
+	
 	lock.unlock();
-	return copied; 
-}
\ No newline at end of file
+	return copied;
+}
+
+
+//
+// ring buffer mode
+//
+
+void MonoSample::_ringAppend( float * buffer, int N, int srcStride ){
+	unsigned int writePos;
+	int space = ring.reserve(N, writePos);
+	if( N > space ){
+		droppedSamples += N - space;
+		N = space;
+	}
+	if( N <= 0 ) return;
+	
+	int first = ring.firstPart(writePos, N);
+	AudioAlgo::copy(ringData+(writePos&ring.mask), 1, buffer, srcStride, first);
+	if( first < N ){
+		AudioAlgo::copy(ringData, 1, buffer+first*srcStride, srcStride, N-first);
+	}
+	
+	ring.publish(writePos, N);
+	totalLength += N;
+}
+
+// consumer side: drop everything that was in the buffer when clear() was called
+void MonoSample::_ringDiscard(){
+	int N = ring.applyDiscard();
+	if( N >= 0 ){
+		totalLength -= N;
+		playbackIndex = 0;
+	}
+}
+
+
+
+//
+// RingIndex
+//
+// positions are free running and wrap around at 2^32, only their difference matters.
+//
+
+RingIndex::RingIndex(){
+	mask = 0;
+	writePos = 0;
+	readPos = 0;
+	discardTo = 0;
+	discardPending = false;
+}
+
+int RingIndex::setup( int capacity ){
+	unsigned int size = 1;
+	while( size < (unsigned int)capacity ) size <<= 1;
+	mask = size-1;
+	return size;
+}
+
+int RingIndex::reserve( int N, unsigned int & pos ){
+	pos = writePos.load(std::memory_order_relaxed);
+	int space = (int)(mask + 1 - (pos - readPos.load(std::memory_order_acquire)));
+	return MIN(N, space);
+}
+
+void RingIndex::publish( unsigned int pos, int N ){
+	writePos.store(pos+N, std::memory_order_release);
+}
+
+int RingIndex::available( unsigned int & pos ){
+	pos = readPos.load(std::memory_order_relaxed);
+	return (int)(writePos.load(std::memory_order_acquire) - pos);
+}
+
+void RingIndex::release( unsigned int pos, int N ){
+	readPos.store(pos+N, std::memory_order_release);
+}
+
+void RingIndex::requestDiscard(){
+	discardTo.store(writePos.load(std::memory_order_acquire), std::memory_order_relaxed);
+	discardPending.store(true, std::memory_order_release);
+}
+
+int RingIndex::applyDiscard(){
+	if( !discardPending.exchange(false, std::memory_order_acquire) ){
+		return -1;
+	}
+	
+	unsigned int pos = readPos.load(std::memory_order_relaxed);
+	int N = (int)(discardTo.load(std::memory_order_relaxed) - pos);
+	if( N <= 0 ) return 0;
+	
+	release(pos, N);
+	return N;
+}
+
+
+
+//
+// StereoSample
+//
+
+StereoSample::StereoSample( int ringCapacity ){
+	totalLength = 0;
+	droppedSamples = 0;
+	int capacity = ring.setup(ringCapacity);
+	leftData = new float[capacity];
+	rightData = new float[capacity];
+	memset( leftData, 0, capacity*sizeof(float) );
+	memset( rightData, 0, capacity*sizeof(float) );
+}
+
+StereoSample::~StereoSample(){
+	delete[] leftData;
+	delete[] rightData;
+}
+
+void StereoSample::append( float * buffer, int N ){
+	unsigned int writePos;
+	int space = ring.reserve(N, writePos);
+	if( N > space ){
+		droppedSamples += N - space;
+		N = space;
+	}
+	if( N <= 0 ) return;
+	
+	int pos = writePos&ring.mask;
+	int first = ring.firstPart(writePos, N);
+	AudioAlgo::deinterleave(leftData+pos, rightData+pos, buffer, first);
+	if( first < N ){
+		AudioAlgo::deinterleave(leftData, rightData, buffer+2*first, N-first);
+	}
+	
+	// both channels become visible at once
+	ring.publish(writePos, N);
+	totalLength += N;
+}
+
+void StereoSample::append( float * left, float * right, int N ){
+	unsigned int writePos;
+	int space = ring.reserve(N, writePos);
+	if( N > space ){
+		droppedSamples += N - space;
+		N = space;
+	}
+	if( N <= 0 ) return;
+	
+	int pos = writePos&ring.mask;
+	int first = ring.firstPart(writePos, N);
+	AudioAlgo::copy(leftData+pos, 1, left, 1, first);
+	AudioAlgo::copy(rightData+pos, 1, right, 1, first);
+	if( first < N ){
+		AudioAlgo::copy(leftData, 1, left+first, 1, N-first);
+		AudioAlgo::copy(rightData, 1, right+first, 1, N-first);
+	}
+	
+	ring.publish(writePos, N);
+	totalLength += N;
+}
+
+void StereoSample::clear(){
+	ring.requestDiscard();
+}
+
+void StereoSample::peekSpan( int N, MonoSample::Span & left, MonoSample::Span & right ){
+	_discard();
+	unsigned int readPos;
+	int available = ring.available(readPos);
+	N = MIN(N, available);
+	
+	int pos = readPos&ring.mask;
+	int first = ring.firstPart(readPos, N);
+	left.data[0] = leftData + pos;
+	left.data[1] = leftData;
+	right.data[0] = rightData + pos;
+	right.data[1] = rightData;
+	left.length[0] = right.length[0] = first;
+	left.length[1] = right.length[1] = N - first;
+}
+
+void StereoSample::consume( int N ){
+	_discard();
+	unsigned int readPos;
+	int available = ring.available(readPos);
+	N = MIN(N, available);
+	if( N > 0 ){
+		ring.release(readPos, N);
+		totalLength -= N;
+	}
+}
+
+void StereoSample::_discard(){
+	int N = ring.applyDiscard();
+	if( N > 0 ){
+		totalLength -= N;
+	}
+}
+
+
+StereoUpsampler::StereoUpsampler(){
+	setup(1);
+}
+
+void StereoUpsampler::setup( int factor ){
+	this->factor = MAX(1,factor);
+	int T = STEREO_UPSAMPLER_TAPS;
+	int L = T*this->factor;
+	
+	// prototype low pass at the input nyquist frequency, blackman windowed.
+	// polyphase component p holds every factor-th tap, starting at p.
+	coeffs.resize(L);
+	double center = (L-1)/2.0;
+	for( int p = 0; p < this->factor; p++ ){
+		double sum = 0;
+		for( int t = 0; t < T; t++ ){
+			int j = p + t*this->factor;
+			double x = (j-center)/this->factor;
+			double sinc = x == 0? 1 : sin(M_PI*x)/(M_PI*x);
+			double window = 0.42 - 0.5*cos(2*M_PI*(j+0.5)/L) + 0.08*cos(4*M_PI*(j+0.5)/L);
+			coeffs[p*T+t] = sinc*window;
+			sum += sinc*window;
+		}
+		// unity gain for every phase, otherwise dc comes out with a ripple
+		for( int t = 0; t < T; t++ ){
+			coeffs[p*T+t] /= sum;
+		}
+	}
+	
+	reset();
+}
+
+int StereoUpsampler::getFactor(){
+	return factor;
+}
+
+void StereoUpsampler::reset(){
+	buffer.assign(2*(STEREO_UPSAMPLER_TAPS-1), 0.0f);
+}
+
+void StereoUpsampler::process( const float * input, int N, float * output ){
+	const int T = STEREO_UPSAMPLER_TAPS;
+	const int H = T-1;
+	buffer.resize(2*(H+N));
+	memcpy(&buffer[2*H], input, 2*N*sizeof(float));
+	
+	for( int n = 0; n < N; n++ ){
+		// x[-2t] is the input frame t steps back
+		const float * x = &buffer[2*(n+H)];
+		for( int p = 0; p < factor; p++ ){
+			const float * h = &coeffs[p*T];
+			float left = 0, right = 0;
+			for( int t = 0; t < T; t++ ){
+				left += h[t]*x[-2*t];
+				right += h[t]*x[-2*t+1];
+			}
+			*output++ = left;
+			*output++ = right;
+		}
+	}
+	
+	// keep the tail as history for the next block
+	memmove(&buffer[0], &buffer[2*N], 2*H*sizeof(float));
+	buffer.resize(2*H);
+}
@@ -3,6 +3,9 @@
 //
 // Initially created by Hansi on 14.06.14.
 //
+// V1.4, 17.10.2026: StereoUpsampler
+// V1.3, 17.10.2026: WakeSignal
+// V1.2, 17.10.2026: optional lock-free ring buffer mode
 // V1.1, 27.10.2015: addTo returns num copied
 // V1.0, 22.6.2015
 //
@@ -14,7 +17,13 @@
 #include "ofConstants.h"
 #include <iostream>
 #include <vector>
+#include <deque>
 #include <math.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <stdint.h>
 
 #if TARGET_OS_IPHONE
 #define USE_ACCELERATE 1
@@ -33,45 +42,39 @@
 /**
  
  Common utility function when handling audio.
- Hardware acceleration is provided by accelerate/blas if enabled.
+ Hardware acceleration is provided by accelerate/blas if enabled,
+ everywhere else by sse2/avx2/neon kernels that are picked at runtime.
  
  **/
 class AudioAlgo{
 public:
 	// absolute value mean
 	static float mean_abs( float * buffer, int N ){
-		float result;
 #ifdef USE_ACCELERATE
+		float result = 0;
 		vDSP_meamgv( buffer, 1, &result, N );
+		return result;
 #else
-		for( int i = N-1; i >= 0; i-- ){
-			result += fabsf( buffer[i] );
-		}
-		result /= N;
+		return kernels().mean_abs( buffer, N );
 #endif
-		return result;
 	}
 	
 	// absolute max
 	static float max_abs( float * buffer, int N ){
-		float result = 0;
 #ifdef USE_ACCELERATE
+		float result = 0;
 		vDSP_maxmgv( buffer, 1, &result, N );
+		return result;
 #else
-		for( int i = N-1; i >= 0; i-- ){
-			result = MAX( fabsf( buffer[i] ), result );
-		}
+		return kernels().max_abs( buffer, N );
 #endif
-		return result;
 	}
 	
 	static void copy( float * destination, int destStride, float * source, int sourceStride, int N ){
 #ifdef USE_BLAS
 		cblas_scopy(N, source, sourceStride, destination, destStride );
 #else
-		for( int i = N-1; i >= 0; i-- ){
-			destination[i*destStride] = source[i*sourceStride];
-		}
+		kernels().copy( destination, destStride, source, sourceStride, N );
 #endif
 	}
 	
@@ -79,12 +82,126 @@ public:
 #ifdef USE_BLAS
 		cblas_sscal( N, factor, destination, 1 );
 #else
-		for( int i = N-1; i >= 0; i-- ){
-			destination[i] *= factor;
-		}
+		kernels().scale( destination, factor, N );
 #endif
 	}
 	
+	// split N interleaved stereo frames into left and right
+	static void deinterleave( float * left, float * right, float * source, int N ){
+#ifdef USE_ACCELERATE
+		DSPSplitComplex split = { left, right };
+		vDSP_ctoz( (DSPComplex*)source, 2, &split, 1, N );
+#else
+		kernels().deinterleave( left, right, source, N );
+#endif
+	}
+	
+	// little endian 16 bit integer samples to float (-1...1)
+	static void int16_to_float( float * destination, const int16_t * source, int N ){
+#ifdef USE_ACCELERATE
+		vDSP_vflt16( source, 1, destination, 1, N );
+		float factor = 1.0f/32768;
+		vDSP_vsmul( destination, 1, &factor, destination, 1, N );
+#else
+		kernels().int16_to_float( destination, source, N );
+#endif
+	}
+	
+	// little endian packed 24 bit integer samples (3 bytes each) to float (-1...1)
+	static void int24_to_float( float * destination, const uint8_t * source, int N ){
+		kernels().int24_to_float( destination, source, N );
+	}
+	
+	
+	// the portable implementations
+	struct Kernels{
+		const char * name;
+		float (*mean_abs)( const float * buffer, int N );
+		float (*max_abs)( const float * buffer, int N );
+		void (*copy)( float * destination, int destStride, const float * source, int sourceStride, int N );
+		void (*scale)( float * destination, float factor, int N );
+		void (*deinterleave)( float * left, float * right, const float * source, int N );
+		void (*int16_to_float)( float * destination, const int16_t * source, int N );
+		void (*int24_to_float)( float * destination, const uint8_t * source, int N );
+	};
+	
+	// fastest kernels for this cpu (avx2, sse2, neon or scalar)
+	static const Kernels & kernels();
+	// plain c++ kernels, mostly for comparison
+	static const Kernels & scalarKernels();
+	// true if the cpu (and the os) can run avx2 code
+	static bool cpuHasAvx2();
+};
+
+
+/**
+ Read/write positions of a lock-free single producer/single consumer ring buffer.
+ The producer owns the write position, the consumer owns the read position.
+ The data itself is kept by the user, indexed with (position&mask).
+ **/
+class RingIndex{
+public:
+	RingIndex();
+	// rounds the capacity up to the next power of two and returns it
+	int setup( int capacity );
+	
+	// producer: how many of N samples fit, starting at pos
+	int reserve( int N, unsigned int & pos );
+	// producer: make N samples starting at pos visible to the consumer
+	void publish( unsigned int pos, int N );
+	
+	// consumer: how many samples can be read, starting at pos
+	int available( unsigned int & pos );
+	// consumer: give N samples starting at pos back to the producer
+	void release( unsigned int pos, int N );
+	
+	// any thread: drop everything that was published so far
+	void requestDiscard();
+	// consumer: carry out a pending discard. returns the number of dropped samples, -1 if nothing was pending.
+	int applyDiscard();
+	
+	// how many of N samples starting at pos fit before the wrap around
+	int firstPart( unsigned int pos, int N ){ return MIN( N, (int)(mask + 1 - (pos&mask)) ); }
+	
+	unsigned int mask;
+	
+private:
+	std::atomic<unsigned int> writePos;
+	std::atomic<unsigned int> readPos;
+	std::atomic<unsigned int> discardTo;
+	std::atomic<bool> discardPending;
+};
+
+
+/**
+ Wakes a worker thread, for example from the audio callback.
+ wake() never blocks: it only sets a flag and notifies, without taking the mutex.
+ The price is that a wake up can slip in between the worker checking the flag and
+ falling asleep, so the worker never sleeps longer than maxSleepMs in one go.
+ **/
+class WakeSignal{
+public:
+	WakeSignal() : requested(false){}
+	
+	// any thread, realtime safe
+	void wake(){
+		requested.store(true, std::memory_order_release);
+		condition.notify_one();
+	}
+	
+	// worker: sleep until woken (or for at most maxSleepMs), then clear the request.
+	// the request is cleared before the worker looks at its data, so nothing gets lost.
+	// returns false if nobody asked.
+	bool wait( int maxSleepMs ){
+		std::unique_lock<std::mutex> lock(mutex);
+		condition.wait_for(lock, std::chrono::milliseconds(maxSleepMs), [this]{ return requested.load(std::memory_order_relaxed); });
+		return requested.exchange(false, std::memory_order_acquire);
+	}
+	
+private:
+	std::atomic<bool> requested;
+	std::mutex mutex;
+	std::condition_variable condition;
 };
 
 
@@ -95,12 +212,31 @@ public:
  * Use different block size for adding/removing samples (better performance when they're the same)
  * Internal locking, so no external locking mechanism is required.
  
+ When created with a ring capacity the sample works in ring buffer mode instead:
+ 
+ * Fixed capacity (rounded up to a power of two), no allocations after construction
+ * Lock-free, for exactly one producer thread (append) and one consumer thread (addTo, peel, skip, peekHead)
+ * clear() may be called from any thread, the consumer drops the data on its next access
+ * Samples that don't fit are dropped and counted in droppedSamples
+ 
  **/
 class MonoSample{
 	
 public:
 	
+	// up to two contiguous ranges of samples, read in place (see peekSpan)
+	struct Span{
+		float * data[2];
+		int length[2];
+		
+		int size() const{ return length[0] + length[1]; }
+		float operator[]( int i ) const{ return i < length[0]? data[0][i] : data[1][i-length[0]]; }
+	};
+	
+	// chunked storage with internal locking
 	MonoSample();
+	// lock-free single producer/single consumer ring buffer with (at least) ringCapacity samples
+	MonoSample( int ringCapacity );
 	~MonoSample();
 	
 	void play();
@@ -113,30 +249,127 @@ public:
 	void append( float * buffer, int N, int srcStride );
 	// remove the top most float buffer from the internal storage (no matter it's size)
 	void removeHead();
-	// clear out all buffers. reset playback index to -1.
+	// clear out all buffers, stop playback and reset the playback index to 0.
+	// in ring buffer mode the index is reset by the consumer on its next access.
 	void clear();
 	// remove N samples from internal storage
 	void peel( int N);
 	// remove the top buffer from the storage and return buffer to the memory (delete manually!). the array size is placed in &numSamples.
+	// not available in ring buffer mode (returns NULL).
 	float * peelHead( int &numSamples );
 	// return a pointer to the head buffer. you have to know waht you're, else the buffer might get deleted while you're looking at it! returns NULL if not available. doesn't modifiy internal storage.
+	// in ring buffer mode there are at most two buffers (before and after the wrap around).
 	float * peekHead( int &numSamples, int bufferNum=0 );
 	
+	// returns the first (up to) N samples without copying them. velocity is not applied.
+	// the data stays valid until it is consumed, only call this from the consuming thread.
+	Span peekSpan( int N );
+	// remove N samples from the front, usually after peekSpan()
+	void consume( int N );
+	
 	// add the N samples to the *output buffer, skipping with outStride (output must be outStride*N large). this does not remove samples from the internal storage. playback index is increased by N.
 	int addTo( float * output, int outStride, int N );
 	
+	bool isRingBuffer(){ return ringData != NULL; }
+	
 	bool playing;
 	int playbackIndex;
-	int totalLength;
+	std::atomic<int> totalLength;
 	bool loop;
 	float velocity;
 	
-	std::vector<float*> bufferData;
-	std::vector<int> bufferSizes;
+	// chunk mode storage. careful: the start of the first chunk might already be peeled.
+	std::deque<float*> bufferData;
+	std::deque<int> bufferSizes;
 	
 	Poco::Mutex lock;
+	
+	// ring buffer mode only: number of samples that didn't fit
+	std::atomic<int> droppedSamples;
 private:
 	void _skip(int numSamples);
+	void _seekCursor();
+	void _headRemoved( int numSamples, int chunkSize );
+	
+	// chunk containing playbackIndex (or before it), and the sample index where that chunk starts
+	int cursorChunk;
+	int cursorStart;
+	// number of samples already peeled from the first chunk
+	int headOffset;
+	
+	void _ringAppend( float * buffer, int N, int srcStride );
+	void _ringDiscard();
+	
+	float * ringData;
+	RingIndex ring;
+};
+
+
+/**
+ Two channels in lock-free ring buffers that share one read/write position,
+ so left and right always hold exactly the same number of samples.
+ Same rules as MonoSample in ring buffer mode: one producer thread (append),
+ one consumer thread (peekSpan, consume), clear() from anywhere.
+ **/
+class StereoSample{
+	
+public:
+	StereoSample( int ringCapacity );
+	~StereoSample();
+	
+	// append N interleaved stereo frames
+	void append( float * buffer, int N );
+	// append N frames from separate left/right buffers
+	void append( float * left, float * right, int N );
+	// drop everything (the consumer does it on its next access)
+	void clear();
+	
+	// the first (up to) N frames of both channels, without copying them.
+	// the data stays valid until it is consumed.
+	void peekSpan( int N, MonoSample::Span & left, MonoSample::Span & right );
+	// remove N frames from the front
+	void consume( int N );
+	
+	// number of frames per channel
+	std::atomic<int> totalLength;
+	// number of frames that didn't fit
+	std::atomic<int> droppedSamples;
+	
+private:
+	void _discard();
+	
+	float * leftData;
+	float * rightData;
+	RingIndex ring;
+};
+
+
+/**
+ Upsamples interleaved stereo by an integer factor with a short polyphase
+ windowed-sinc filter (STEREO_UPSAMPLER_TAPS taps per phase).
+ Keeps a few frames of history, so it can be fed block by block.
+ The output lags the input by about STEREO_UPSAMPLER_TAPS/2 input frames.
+ **/
+#define STEREO_UPSAMPLER_TAPS 8
+class StereoUpsampler{
+	
+public:
+	StereoUpsampler();
+	
+	void setup( int factor );
+	int getFactor();
+	// forget the history, eg. after seeking
+	void reset();
+	
+	// upsample N frames, output needs room for N*factor frames
+	void process( const float * input, int N, float * output );
+	
+private:
+	int factor;
+	// coefficients, one row of taps per phase
+	std::vector<float> coeffs;
+	// STEREO_UPSAMPLER_TAPS-1 frames of history followed by the current input
+	std::vector<float> buffer;
 };
 
 #endif /* defined(__AudioAlgo_h__) */
@@ -0,0 +1,602 @@
+//
+//  BeamMath.cpp
+//  Oscilloscope
+//
+
+#include "BeamMath.h"
+#include "Audio.h"
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifndef MIN
+#define MIN(a,b) (a<b?a:b)
+#endif
+
+#ifndef MAX
+#define MAX(a,b) (a>b?a:b)
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BEAM_MATH_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define BEAM_MATH_AVX2
+#else
+#define BEAM_MATH_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define BEAM_MATH_NEON 1
+#include <arm_neon.h>
+#endif
+
+// erf, abramowitz-stegun 7.1.27
+#define ERF_A1 0.278393f
+#define ERF_A2 0.230389f
+#define ERF_A3 0.000972f
+#define ERF_A4 0.078108f
+
+// exp and log (cephes). ln(2) is split in two so n*ln(2) stays exact.
+#define EXP_LO -87.3f
+#define EXP_HI 88.3f
+#define LOG2E 1.44269504088896341f
+#define LN2_C1 0.693359375f
+#define LN2_C2 -2.12194440e-4f
+#define EXP_P0 1.9875691500E-4f
+#define EXP_P1 1.3981999507E-3f
+#define EXP_P2 8.3334519073E-3f
+#define EXP_P3 4.1665795894E-2f
+#define EXP_P4 1.6666665459E-1f
+#define EXP_P5 5.0000001201E-1f
+#define SQRTHF 0.707106781186547524f
+#define LOG_P0 7.0376836292E-2f
+#define LOG_P1 -1.1514610310E-1f
+#define LOG_P2 1.1676998740E-1f
+#define LOG_P3 -1.2420140846E-1f
+#define LOG_P4 1.4249322787E-1f
+#define LOG_P5 -1.6668057665E-1f
+#define LOG_P6 2.0000714765E-1f
+#define LOG_P7 -2.4999993993E-1f
+#define LOG_P8 3.3333331174E-1f
+
+// sqrt(2*pi)
+#define TAUR 2.5066282746310002f
+
+// below this the beam is invisible, and log() would see denormals
+#define BEAM_MIN_ALPHA 1E-30f
+
+
+//
+// the scalar versions. the vector versions below do exactly the same, step by step.
+//
+
+namespace{
+	inline float erf1( float x ){
+		float a = fabsf(x);
+		float t = ERF_A4;
+		t = t*a + ERF_A3;
+		t = t*a + ERF_A2;
+		t = t*a + ERF_A1;
+		t = t*a + 1.0f;
+		t = t*t;
+		float r = 1.0f - 1.0f/(t*t);
+		return copysignf(r, x);
+	}
+	
+	inline float exp1( float x ){
+		x = MIN(MAX(x, EXP_LO), EXP_HI);
+		float n = floorf(x*LOG2E + 0.5f);
+		float r = x - n*LN2_C1;
+		r = r - n*LN2_C2;
+		float p = EXP_P0;
+		p = p*r + EXP_P1;
+		p = p*r + EXP_P2;
+		p = p*r + EXP_P3;
+		p = p*r + EXP_P4;
+		p = p*r + EXP_P5;
+		p = (p*(r*r) + r) + 1.0f;
+		// 2^n, straight into the exponent bits
+		int32_t bits = ((int32_t)n + 127) << 23;
+		float scale;
+		memcpy(&scale, &bits, 4);
+		return p*scale;
+	}
+	
+	inline float log1( float x ){
+		int32_t bits;
+		memcpy(&bits, &x, 4);
+		float e = (float)((bits >> 23) - 126);
+		bits = (bits & 0x807fffff) | 0x3f000000;
+		float m;
+		memcpy(&m, &bits, 4);
+		// m from [0.5,1) to [sqrt(0.5),sqrt(2)), minus one
+		float below = m < SQRTHF? 1.0f : 0.0f;
+		e = e - below;
+		m = (m + m*below) - 1.0f;
+		float z = m*m;
+		float y = LOG_P0;
+		y = y*m + LOG_P1;
+		y = y*m + LOG_P2;
+		y = y*m + LOG_P3;
+		y = y*m + LOG_P4;
+		y = y*m + LOG_P5;
+		y = y*m + LOG_P6;
+		y = y*m + LOG_P7;
+		y = y*m + LOG_P8;
+		y = (y*m)*z;
+		y = y + e*LN2_C2;
+		y = y - 0.5f*z;
+		m = m + y;
+		return m + e*LN2_C1;
+	}
+	
+	// pow(alpha, exponent)*gain, zero for an invisible beam
+	inline float curve1( float a, const BeamMath::Beam & b ){
+		return a > BEAM_MIN_ALPHA? exp1(b.exponent*log1(a))*b.gain : 0.0f;
+	}
+	
+	// pixels i...N-1 of a row, also the tail of the vector kernels
+	void beam_row_from( float * alpha, float x, float dx, float y, float dy, const BeamMath::Beam & b, int i, int N ){
+		if( b.len > 0 ){
+			for( ; i < N; i++ ){
+				float fi = (float)i;
+				float xi = x + dx*fi;
+				float yi = y + dy*fi;
+				float a = (erf1(xi*b.invS) - erf1((xi-b.len)*b.invS))*exp1(-(yi*yi)*b.inv2s2);
+				alpha[i] = curve1(a*b.scale, b);
+			}
+		}
+		else{
+			for( ; i < N; i++ ){
+				float fi = (float)i;
+				float xi = x + dx*fi;
+				float yi = y + dy*fi;
+				float a = exp1(-(xi*xi + yi*yi)*b.inv2s2);
+				alpha[i] = curve1(a*b.scale, b);
+			}
+		}
+	}
+	
+	void erf_scalar( float * destination, const float * source, int N ){
+		for( int i = 0; i < N; i++ ){
+			destination[i] = erf1(source[i]);
+		}
+	}
+	
+	void exp_scalar( float * destination, const float * source, int N ){
+		for( int i = 0; i < N; i++ ){
+			destination[i] = exp1(source[i]);
+		}
+	}
+	
+	void gaussian_scalar( float * destination, const float * source, float sigma, int N ){
+		float inv2s2 = 1.0f/(2.0f*sigma*sigma);
+		float norm = 1.0f/(TAUR*sigma);
+		for( int i = 0; i < N; i++ ){
+			float x = source[i];
+			destination[i] = exp1(-(x*x)*inv2s2)*norm;
+		}
+	}
+	
+	void beam_row_scalar( float * alpha, float x, float dx, float y, float dy, const BeamMath::Beam & b, int N ){
+		beam_row_from( alpha, x, dx, y, dy, b, 0, N );
+	}
+	
+	
+#ifdef BEAM_MATH_X86
+	inline __m128 erf_sse2( __m128 x ){
+		const __m128 sign = _mm_set1_ps( -0.0f );
+		const __m128 one = _mm_set1_ps( 1.0f );
+		__m128 a = _mm_andnot_ps( sign, x );
+		__m128 t = _mm_set1_ps( ERF_A4 );
+		t = _mm_add_ps( _mm_mul_ps( t, a ), _mm_set1_ps( ERF_A3 ) );
+		t = _mm_add_ps( _mm_mul_ps( t, a ), _mm_set1_ps( ERF_A2 ) );
+		t = _mm_add_ps( _mm_mul_ps( t, a ), _mm_set1_ps( ERF_A1 ) );
+		t = _mm_add_ps( _mm_mul_ps( t, a ), one );
+		t = _mm_mul_ps( t, t );
+		__m128 r = _mm_sub_ps( one, _mm_div_ps( one, _mm_mul_ps( t, t ) ) );
+		return _mm_or_ps( r, _mm_and_ps( sign, x ) );
+	}
+	
+	inline __m128 exp_sse2( __m128 x ){
+		const __m128 one = _mm_set1_ps( 1.0f );
+		x = _mm_min_ps( _mm_max_ps( x, _mm_set1_ps( EXP_LO ) ), _mm_set1_ps( EXP_HI ) );
+		__m128 fx = _mm_add_ps( _mm_mul_ps( x, _mm_set1_ps( LOG2E ) ), _mm_set1_ps( 0.5f ) );
+		// floor, sse2 only truncates
+		__m128 t = _mm_cvtepi32_ps( _mm_cvttps_epi32( fx ) );
+		__m128 n = _mm_sub_ps( t, _mm_and_ps( _mm_cmpgt_ps( t, fx ), one ) );
+		__m128 r = _mm_sub_ps( x, _mm_mul_ps( n, _mm_set1_ps( LN2_C1 ) ) );
+		r = _mm_sub_ps( r, _mm_mul_ps( n, _mm_set1_ps( LN2_C2 ) ) );
+		__m128 p = _mm_set1_ps( EXP_P0 );
+		p = _mm_add_ps( _mm_mul_ps( p, r ), _mm_set1_ps( EXP_P1 ) );
+		p = _mm_add_ps( _mm_mul_ps( p, r ), _mm_set1_ps( EXP_P2 ) );
+		p = _mm_add_ps( _mm_mul_ps( p, r ), _mm_set1_ps( EXP_P3 ) );
+		p = _mm_add_ps( _mm_mul_ps( p, r ), _mm_set1_ps( EXP_P4 ) );
+		p = _mm_add_ps( _mm_mul_ps( p, r ), _mm_set1_ps( EXP_P5 ) );
+		p = _mm_add_ps( _mm_add_ps( _mm_mul_ps( p, _mm_mul_ps( r, r ) ), r ), one );
+		__m128i bits = _mm_slli_epi32( _mm_add_epi32( _mm_cvttps_epi32( n ), _mm_set1_epi32( 127 ) ), 23 );
+		return _mm_mul_ps( p, _mm_castsi128_ps( bits ) );
+	}
+	
+	inline __m128 log_sse2( __m128 x ){
+		const __m128 one = _mm_set1_ps( 1.0f );
+		__m128i bits = _mm_castps_si128( x );
+		__m128 e = _mm_cvtepi32_ps( _mm_sub_epi32( _mm_srli_epi32( bits, 23 ), _mm_set1_epi32( 126 ) ) );
+		__m128 m = _mm_castsi128_ps( _mm_or_si128( _mm_and_si128( bits, _mm_set1_epi32( 0x807fffff ) ), _mm_set1_epi32( 0x3f000000 ) ) );
+		__m128 below = _mm_and_ps( _mm_cmplt_ps( m, _mm_set1_ps( SQRTHF ) ), one );
+		e = _mm_sub_ps( e, below );
+		m = _mm_sub_ps( _mm_add_ps( m, _mm_mul_ps( m, below ) ), one );
+		__m128 z = _mm_mul_ps( m, m );
+		__m128 y = _mm_set1_ps( LOG_P0 );
+		y = _mm_add_ps( _mm_mul_ps( y, m ), _mm_set1_ps( LOG_P1 ) );
+		y = _mm_add_ps( _mm_mul_ps( y, m ), _mm_set1_ps( LOG_P2 ) );
+		y = _mm_add_ps( _mm_mul_ps( y, m ), _mm_set1_ps( LOG_P3 ) );
+		y = _mm_add_ps( _mm_mul_ps( y, m ), _mm_set1_ps( LOG_P4 ) );
+		y = _mm_add_ps( _mm_mul_ps( y, m ), _mm_set1_ps( LOG_P5 ) );
+		y = _mm_add_ps( _mm_mul_ps( y, m ), _mm_set1_ps( LOG_P6 ) );
+		y = _mm_add_ps( _mm_mul_ps( y, m ), _mm_set1_ps( LOG_P7 ) );
+		y = _mm_add_ps( _mm_mul_ps( y, m ), _mm_set1_ps( LOG_P8 ) );
+		y = _mm_mul_ps( _mm_mul_ps( y, m ), z );
+		y = _mm_add_ps( y, _mm_mul_ps( e, _mm_set1_ps( LN2_C2 ) ) );
+		y = _mm_sub_ps( y, _mm_mul_ps( _mm_set1_ps( 0.5f ), z ) );
+		m = _mm_add_ps( m, y );
+		return _mm_add_ps( m, _mm_mul_ps( e, _mm_set1_ps( LN2_C1 ) ) );
+	}
+	
+	inline __m128 curve_sse2( __m128 a, const BeamMath::Beam & b ){
+		const __m128 minAlpha = _mm_set1_ps( BEAM_MIN_ALPHA );
+		__m128 visible = _mm_cmpgt_ps( a, minAlpha );
+		__m128 p = _mm_mul_ps( _mm_set1_ps( b.exponent ), log_sse2( _mm_max_ps( a, minAlpha ) ) );
+		return _mm_and_ps( visible, _mm_mul_ps( exp_sse2( p ), _mm_set1_ps( b.gain ) ) );
+	}
+	
+	void erf_sse2( float * destination, const float * source, int N ){
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			_mm_storeu_ps( destination+i, erf_sse2( _mm_loadu_ps( source+i ) ) );
+		}
+		erf_scalar( destination+i, source+i, N-i );
+	}
+	
+	void exp_sse2( float * destination, const float * source, int N ){
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			_mm_storeu_ps( destination+i, exp_sse2( _mm_loadu_ps( source+i ) ) );
+		}
+		exp_scalar( destination+i, source+i, N-i );
+	}
+	
+	void gaussian_sse2( float * destination, const float * source, float sigma, int N ){
+		__m128 inv2s2 = _mm_set1_ps( 1.0f/(2.0f*sigma*sigma) );
+		__m128 norm = _mm_set1_ps( 1.0f/(TAUR*sigma) );
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			__m128 x = _mm_loadu_ps( source+i );
+			__m128 q = _mm_sub_ps( _mm_setzero_ps(), _mm_mul_ps( x, x ) );
+			_mm_storeu_ps( destination+i, _mm_mul_ps( exp_sse2( _mm_mul_ps( q, inv2s2 ) ), norm ) );
+		}
+		gaussian_scalar( destination+i, source+i, sigma, N-i );
+	}
+	
+	void beam_row_sse2( float * alpha, float x, float dx, float y, float dy, const BeamMath::Beam & b, int N ){
+		const __m128 lanes = _mm_setr_ps( 0, 1, 2, 3 );
+		__m128 vx = _mm_set1_ps( x ), vdx = _mm_set1_ps( dx );
+		__m128 vy = _mm_set1_ps( y ), vdy = _mm_set1_ps( dy );
+		__m128 invS = _mm_set1_ps( b.invS ), inv2s2 = _mm_set1_ps( b.inv2s2 );
+		__m128 len = _mm_set1_ps( b.len ), scale = _mm_set1_ps( b.scale );
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			__m128 fi = _mm_add_ps( _mm_set1_ps( (float)i ), lanes );
+			__m128 xi = _mm_add_ps( vx, _mm_mul_ps( vdx, fi ) );
+			__m128 yi = _mm_add_ps( vy, _mm_mul_ps( vdy, fi ) );
+			__m128 a;
+			if( b.len > 0 ){
+				__m128 q = _mm_sub_ps( _mm_setzero_ps(), _mm_mul_ps( yi, yi ) );
+				__m128 e = _mm_sub_ps( erf_sse2( _mm_mul_ps( xi, invS ) ), erf_sse2( _mm_mul_ps( _mm_sub_ps( xi, len ), invS ) ) );
+				a = _mm_mul_ps( e, exp_sse2( _mm_mul_ps( q, inv2s2 ) ) );
+			}
+			else{
+				__m128 q = _mm_sub_ps( _mm_setzero_ps(), _mm_add_ps( _mm_mul_ps( xi, xi ), _mm_mul_ps( yi, yi ) ) );
+				a = exp_sse2( _mm_mul_ps( q, inv2s2 ) );
+			}
+			_mm_storeu_ps( alpha+i, curve_sse2( _mm_mul_ps( a, scale ), b ) );
+		}
+		beam_row_from( alpha, x, dx, y, dy, b, i, N );
+	}
+	
+	BEAM_MATH_AVX2 inline __m256 erf_avx2( __m256 x ){
+		const __m256 sign = _mm256_set1_ps( -0.0f );
+		const __m256 one = _mm256_set1_ps( 1.0f );
+		__m256 a = _mm256_andnot_ps( sign, x );
+		__m256 t = _mm256_set1_ps( ERF_A4 );
+		t = _mm256_add_ps( _mm256_mul_ps( t, a ), _mm256_set1_ps( ERF_A3 ) );
+		t = _mm256_add_ps( _mm256_mul_ps( t, a ), _mm256_set1_ps( ERF_A2 ) );
+		t = _mm256_add_ps( _mm256_mul_ps( t, a ), _mm256_set1_ps( ERF_A1 ) );
+		t = _mm256_add_ps( _mm256_mul_ps( t, a ), one );
+		t = _mm256_mul_ps( t, t );
+		__m256 r = _mm256_sub_ps( one, _mm256_div_ps( one, _mm256_mul_ps( t, t ) ) );
+		return _mm256_or_ps( r, _mm256_and_ps( sign, x ) );
+	}
+	
+	BEAM_MATH_AVX2 inline __m256 exp_avx2( __m256 x ){
+		const __m256 one = _mm256_set1_ps( 1.0f );
+		x = _mm256_min_ps( _mm256_max_ps( x, _mm256_set1_ps( EXP_LO ) ), _mm256_set1_ps( EXP_HI ) );
+		__m256 fx = _mm256_add_ps( _mm256_mul_ps( x, _mm256_set1_ps( LOG2E ) ), _mm256_set1_ps( 0.5f ) );
+		__m256 n = _mm256_floor_ps( fx );
+		__m256 r = _mm256_sub_ps( x, _mm256_mul_ps( n, _mm256_set1_ps( LN2_C1 ) ) );
+		r = _mm256_sub_ps( r, _mm256_mul_ps( n, _mm256_set1_ps( LN2_C2 ) ) );
+		__m256 p = _mm256_set1_ps( EXP_P0 );
+		p = _mm256_add_ps( _mm256_mul_ps( p, r ), _mm256_set1_ps( EXP_P1 ) );
+		p = _mm256_add_ps( _mm256_mul_ps( p, r ), _mm256_set1_ps( EXP_P2 ) );
+		p = _mm256_add_ps( _mm256_mul_ps( p, r ), _mm256_set1_ps( EXP_P3 ) );
+		p = _mm256_add_ps( _mm256_mul_ps( p, r ), _mm256_set1_ps( EXP_P4 ) );
+		p = _mm256_add_ps( _mm256_mul_ps( p, r ), _mm256_set1_ps( EXP_P5 ) );
+		p = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( p, _mm256_mul_ps( r, r ) ), r ), one );
+		__m256i bits = _mm256_slli_epi32( _mm256_add_epi32( _mm256_cvttps_epi32( n ), _mm256_set1_epi32( 127 ) ), 23 );
+		return _mm256_mul_ps( p, _mm256_castsi256_ps( bits ) );
+	}
+	
+	BEAM_MATH_AVX2 inline __m256 log_avx2( __m256 x ){
+		const __m256 one = _mm256_set1_ps( 1.0f );
+		__m256i bits = _mm256_castps_si256( x );
+		__m256 e = _mm256_cvtepi32_ps( _mm256_sub_epi32( _mm256_srli_epi32( bits, 23 ), _mm256_set1_epi32( 126 ) ) );
+		__m256 m = _mm256_castsi256_ps( _mm256_or_si256( _mm256_and_si256( bits, _mm256_set1_epi32( 0x807fffff ) ), _mm256_set1_epi32( 0x3f000000 ) ) );
+		__m256 below = _mm256_and_ps( _mm256_cmp_ps( m, _mm256_set1_ps( SQRTHF ), _CMP_LT_OQ ), one );
+		e = _mm256_sub_ps( e, below );
+		m = _mm256_sub_ps( _mm256_add_ps( m, _mm256_mul_ps( m, below ) ), one );
+		__m256 z = _mm256_mul_ps( m, m );
+		__m256 y = _mm256_set1_ps( LOG_P0 );
+		y = _mm256_add_ps( _mm256_mul_ps( y, m ), _mm256_set1_ps( LOG_P1 ) );
+		y = _mm256_add_ps( _mm256_mul_ps( y, m ), _mm256_set1_ps( LOG_P2 ) );
+		y = _mm256_add_ps( _mm256_mul_ps( y, m ), _mm256_set1_ps( LOG_P3 ) );
+		y = _mm256_add_ps( _mm256_mul_ps( y, m ), _mm256_set1_ps( LOG_P4 ) );
+		y = _mm256_add_ps( _mm256_mul_ps( y, m ), _mm256_set1_ps( LOG_P5 ) );
+		y = _mm256_add_ps( _mm256_mul_ps( y, m ), _mm256_set1_ps( LOG_P6 ) );
+		y = _mm256_add_ps( _mm256_mul_ps( y, m ), _mm256_set1_ps( LOG_P7 ) );
+		y = _mm256_add_ps( _mm256_mul_ps( y, m ), _mm256_set1_ps( LOG_P8 ) );
+		y = _mm256_mul_ps( _mm256_mul_ps( y, m ), z );
+		y = _mm256_add_ps( y, _mm256_mul_ps( e, _mm256_set1_ps( LN2_C2 ) ) );
+		y = _mm256_sub_ps( y, _mm256_mul_ps( _mm256_set1_ps( 0.5f ), z ) );
+		m = _mm256_add_ps( m, y );
+		return _mm256_add_ps( m, _mm256_mul_ps( e, _mm256_set1_ps( LN2_C1 ) ) );
+	}
+	
+	BEAM_MATH_AVX2 inline __m256 curve_avx2( __m256 a, const BeamMath::Beam & b ){
+		const __m256 minAlpha = _mm256_set1_ps( BEAM_MIN_ALPHA );
+		__m256 visible = _mm256_cmp_ps( a, minAlpha, _CMP_GT_OQ );
+		__m256 p = _mm256_mul_ps( _mm256_set1_ps( b.exponent ), log_avx2( _mm256_max_ps( a, minAlpha ) ) );
+		return _mm256_and_ps( visible, _mm256_mul_ps( exp_avx2( p ), _mm256_set1_ps( b.gain ) ) );
+	}
+	
+	BEAM_MATH_AVX2 void erf_avx2( float * destination, const float * source, int N ){
+		int i = 0;
+		for( ; i + 8 <= N; i += 8 ){
+			_mm256_storeu_ps( destination+i, erf_avx2( _mm256_loadu_ps( source+i ) ) );
+		}
+		erf_scalar( destination+i, source+i, N-i );
+	}
+	
+	BEAM_MATH_AVX2 void exp_avx2( float * destination, const float * source, int N ){
+		int i = 0;
+		for( ; i + 8 <= N; i += 8 ){
+			_mm256_storeu_ps( destination+i, exp_avx2( _mm256_loadu_ps( source+i ) ) );
+		}
+		exp_scalar( destination+i, source+i, N-i );
+	}
+	
+	BEAM_MATH_AVX2 void gaussian_avx2( float * destination, const float * source, float sigma, int N ){
+		__m256 inv2s2 = _mm256_set1_ps( 1.0f/(2.0f*sigma*sigma) );
+		__m256 norm = _mm256_set1_ps( 1.0f/(TAUR*sigma) );
+		int i = 0;
+		for( ; i + 8 <= N; i += 8 ){
+			__m256 x = _mm256_loadu_ps( source+i );
+			__m256 q = _mm256_sub_ps( _mm256_setzero_ps(), _mm256_mul_ps( x, x ) );
+			_mm256_storeu_ps( destination+i, _mm256_mul_ps( exp_avx2( _mm256_mul_ps( q, inv2s2 ) ), norm ) );
+		}
+		gaussian_scalar( destination+i, source+i, sigma, N-i );
+	}
+	
+	BEAM_MATH_AVX2 void beam_row_avx2( float * alpha, float x, float dx, float y, float dy, const BeamMath::Beam & b, int N ){
+		const __m256 lanes = _mm256_setr_ps( 0, 1, 2, 3, 4, 5, 6, 7 );
+		__m256 vx = _mm256_set1_ps( x ), vdx = _mm256_set1_ps( dx );
+		__m256 vy = _mm256_set1_ps( y ), vdy = _mm256_set1_ps( dy );
+		__m256 invS = _mm256_set1_ps( b.invS ), inv2s2 = _mm256_set1_ps( b.inv2s2 );
+		__m256 len = _mm256_set1_ps( b.len ), scale = _mm256_set1_ps( b.scale );
+		int i = 0;
+		for( ; i + 8 <= N; i += 8 ){
+			__m256 fi = _mm256_add_ps( _mm256_set1_ps( (float)i ), lanes );
+			__m256 xi = _mm256_add_ps( vx, _mm256_mul_ps( vdx, fi ) );
+			__m256 yi = _mm256_add_ps( vy, _mm256_mul_ps( vdy, fi ) );
+			__m256 a;
+			if( b.len > 0 ){
+				__m256 q = _mm256_sub_ps( _mm256_setzero_ps(), _mm256_mul_ps( yi, yi ) );
+				__m256 e = _mm256_sub_ps( erf_avx2( _mm256_mul_ps( xi, invS ) ), erf_avx2( _mm256_mul_ps( _mm256_sub_ps( xi, len ), invS ) ) );
+				a = _mm256_mul_ps( e, exp_avx2( _mm256_mul_ps( q, inv2s2 ) ) );
+			}
+			else{
+				__m256 q = _mm256_sub_ps( _mm256_setzero_ps(), _mm256_add_ps( _mm256_mul_ps( xi, xi ), _mm256_mul_ps( yi, yi ) ) );
+				a = exp_avx2( _mm256_mul_ps( q, inv2s2 ) );
+			}
+			_mm256_storeu_ps( alpha+i, curve_avx2( _mm256_mul_ps( a, scale ), b ) );
+		}
+		beam_row_from( alpha, x, dx, y, dy, b, i, N );
+	}
+#endif
+	
+#ifdef BEAM_MATH_NEON
+	inline float32x4_t div_neon( float32x4_t a, float32x4_t b ){
+#if defined(__aarch64__)
+		return vdivq_f32( a, b );
+#else
+		// armv7 has no division, two newton steps get close to it
+		float32x4_t r = vrecpeq_f32( b );
+		r = vmulq_f32( vrecpsq_f32( b, r ), r );
+		r = vmulq_f32( vrecpsq_f32( b, r ), r );
+		return vmulq_f32( a, r );
+#endif
+	}
+	
+	inline float32x4_t erf_neon( float32x4_t x ){
+		const uint32x4_t sign = vdupq_n_u32( 0x80000000 );
+		const float32x4_t one = vdupq_n_f32( 1.0f );
+		float32x4_t a = vabsq_f32( x );
+		float32x4_t t = vdupq_n_f32( ERF_A4 );
+		t = vaddq_f32( vmulq_f32( t, a ), vdupq_n_f32( ERF_A3 ) );
+		t = vaddq_f32( vmulq_f32( t, a ), vdupq_n_f32( ERF_A2 ) );
+		t = vaddq_f32( vmulq_f32( t, a ), vdupq_n_f32( ERF_A1 ) );
+		t = vaddq_f32( vmulq_f32( t, a ), one );
+		t = vmulq_f32( t, t );
+		float32x4_t r = vsubq_f32( one, div_neon( one, vmulq_f32( t, t ) ) );
+		return vreinterpretq_f32_u32( vorrq_u32( vreinterpretq_u32_f32( r ), vandq_u32( vreinterpretq_u32_f32( x ), sign ) ) );
+	}
+	
+	inline float32x4_t exp_neon( float32x4_t x ){
+		const float32x4_t one = vdupq_n_f32( 1.0f );
+		x = vminq_f32( vmaxq_f32( x, vdupq_n_f32( EXP_LO ) ), vdupq_n_f32( EXP_HI ) );
+		float32x4_t fx = vaddq_f32( vmulq_f32( x, vdupq_n_f32( LOG2E ) ), vdupq_n_f32( 0.5f ) );
+		// floor, the conversion truncates
+		float32x4_t t = vcvtq_f32_s32( vcvtq_s32_f32( fx ) );
+		float32x4_t n = vsubq_f32( t, vreinterpretq_f32_u32( vandq_u32( vcgtq_f32( t, fx ), vreinterpretq_u32_f32( one ) ) ) );
+		float32x4_t r = vsubq_f32( x, vmulq_f32( n, vdupq_n_f32( LN2_C1 ) ) );
+		r = vsubq_f32( r, vmulq_f32( n, vdupq_n_f32( LN2_C2 ) ) );
+		float32x4_t p = vdupq_n_f32( EXP_P0 );
+		p = vaddq_f32( vmulq_f32( p, r ), vdupq_n_f32( EXP_P1 ) );
+		p = vaddq_f32( vmulq_f32( p, r ), vdupq_n_f32( EXP_P2 ) );
+		p = vaddq_f32( vmulq_f32( p, r ), vdupq_n_f32( EXP_P3 ) );
+		p = vaddq_f32( vmulq_f32( p, r ), vdupq_n_f32( EXP_P4 ) );
+		p = vaddq_f32( vmulq_f32( p, r ), vdupq_n_f32( EXP_P5 ) );
+		p = vaddq_f32( vaddq_f32( vmulq_f32( p, vmulq_f32( r, r ) ), r ), one );
+		int32x4_t bits = vshlq_n_s32( vaddq_s32( vcvtq_s32_f32( n ), vdupq_n_s32( 127 ) ), 23 );
+		return vmulq_f32( p, vreinterpretq_f32_s32( bits ) );
+	}
+	
+	inline float32x4_t log_neon( float32x4_t x ){
+		const float32x4_t one = vdupq_n_f32( 1.0f );
+		int32x4_t bits = vreinterpretq_s32_f32( x );
+		float32x4_t e = vcvtq_f32_s32( vsubq_s32( vshrq_n_s32( bits, 23 ), vdupq_n_s32( 126 ) ) );
+		float32x4_t m = vreinterpretq_f32_s32( vorrq_s32( vandq_s32( bits, vdupq_n_s32( 0x807fffff ) ), vdupq_n_s32( 0x3f000000 ) ) );
+		float32x4_t below = vreinterpretq_f32_u32( vandq_u32( vcltq_f32( m, vdupq_n_f32( SQRTHF ) ), vreinterpretq_u32_f32( one ) ) );
+		e = vsubq_f32( e, below );
+		m = vsubq_f32( vaddq_f32( m, vmulq_f32( m, below ) ), one );
+		float32x4_t z = vmulq_f32( m, m );
+		float32x4_t y = vdupq_n_f32( LOG_P0 );
+		y = vaddq_f32( vmulq_f32( y, m ), vdupq_n_f32( LOG_P1 ) );
+		y = vaddq_f32( vmulq_f32( y, m ), vdupq_n_f32( LOG_P2 ) );
+		y = vaddq_f32( vmulq_f32( y, m ), vdupq_n_f32( LOG_P3 ) );
+		y = vaddq_f32( vmulq_f32( y, m ), vdupq_n_f32( LOG_P4 ) );
+		y = vaddq_f32( vmulq_f32( y, m ), vdupq_n_f32( LOG_P5 ) );
+		y = vaddq_f32( vmulq_f32( y, m ), vdupq_n_f32( LOG_P6 ) );
+		y = vaddq_f32( vmulq_f32( y, m ), vdupq_n_f32( LOG_P7 ) );
+		y = vaddq_f32( vmulq_f32( y, m ), vdupq_n_f32( LOG_P8 ) );
+		y = vmulq_f32( vmulq_f32( y, m ), z );
+		y = vaddq_f32( y, vmulq_f32( e, vdupq_n_f32( LN2_C2 ) ) );
+		y = vsubq_f32( y, vmulq_f32( vdupq_n_f32( 0.5f ), z ) );
+		m = vaddq_f32( m, y );
+		return vaddq_f32( m, vmulq_f32( e, vdupq_n_f32( LN2_C1 ) ) );
+	}
+	
+	inline float32x4_t curve_neon( float32x4_t a, const BeamMath::Beam & b ){
+		const float32x4_t minAlpha = vdupq_n_f32( BEAM_MIN_ALPHA );
+		uint32x4_t visible = vcgtq_f32( a, minAlpha );
+		float32x4_t p = vmulq_f32( vdupq_n_f32( b.exponent ), log_neon( vmaxq_f32( a, minAlpha ) ) );
+		float32x4_t result = vmulq_f32( exp_neon( p ), vdupq_n_f32( b.gain ) );
+		return vreinterpretq_f32_u32( vandq_u32( visible, vreinterpretq_u32_f32( result ) ) );
+	}
+	
+	void erf_neon( float * destination, const float * source, int N ){
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			vst1q_f32( destination+i, erf_neon( vld1q_f32( source+i ) ) );
+		}
+		erf_scalar( destination+i, source+i, N-i );
+	}
+	
+	void exp_neon( float * destination, const float * source, int N ){
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			vst1q_f32( destination+i, exp_neon( vld1q_f32( source+i ) ) );
+		}
+		exp_scalar( destination+i, source+i, N-i );
+	}
+	
+	void gaussian_neon( float * destination, const float * source, float sigma, int N ){
+		float32x4_t inv2s2 = vdupq_n_f32( 1.0f/(2.0f*sigma*sigma) );
+		float32x4_t norm = vdupq_n_f32( 1.0f/(TAUR*sigma) );
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			float32x4_t x = vld1q_f32( source+i );
+			float32x4_t q = vnegq_f32( vmulq_f32( x, x ) );
+			vst1q_f32( destination+i, vmulq_f32( exp_neon( vmulq_f32( q, inv2s2 ) ), norm ) );
+		}
+		gaussian_scalar( destination+i, source+i, sigma, N-i );
+	}
+	
+	void beam_row_neon( float * alpha, float x, float dx, float y, float dy, const BeamMath::Beam & b, int N ){
+		const float lanesData[4] = { 0, 1, 2, 3 };
+		const float32x4_t lanes = vld1q_f32( lanesData );
+		float32x4_t vx = vdupq_n_f32( x ), vdx = vdupq_n_f32( dx );
+		float32x4_t vy = vdupq_n_f32( y ), vdy = vdupq_n_f32( dy );
+		float32x4_t invS = vdupq_n_f32( b.invS ), inv2s2 = vdupq_n_f32( b.inv2s2 );
+		float32x4_t len = vdupq_n_f32( b.len ), scale = vdupq_n_f32( b.scale );
+		int i = 0;
+		for( ; i + 4 <= N; i += 4 ){
+			float32x4_t fi = vaddq_f32( vdupq_n_f32( (float)i ), lanes );
+			float32x4_t xi = vaddq_f32( vx, vmulq_f32( vdx, fi ) );
+			float32x4_t yi = vaddq_f32( vy, vmulq_f32( vdy, fi ) );
+			float32x4_t a;
+			if( b.len > 0 ){
+				float32x4_t q = vnegq_f32( vmulq_f32( yi, yi ) );
+				float32x4_t e = vsubq_f32( erf_neon( vmulq_f32( xi, invS ) ), erf_neon( vmulq_f32( vsubq_f32( xi, len ), invS ) ) );
+				a = vmulq_f32( e, exp_neon( vmulq_f32( q, inv2s2 ) ) );
+			}
+			else{
+				float32x4_t q = vnegq_f32( vaddq_f32( vmulq_f32( xi, xi ), vmulq_f32( yi, yi ) ) );
+				a = exp_neon( vmulq_f32( q, inv2s2 ) );
+			}
+			vst1q_f32( alpha+i, curve_neon( vmulq_f32( a, scale ), b ) );
+		}
+		beam_row_from( alpha, x, dx, y, dy, b, i, N );
+	}
+#endif
+	
+	BeamMath::Kernels pick_kernels(){
+#ifdef BEAM_MATH_X86
+		if( AudioAlgo::cpuHasAvx2() ){
+			return { "avx2", erf_avx2, exp_avx2, gaussian_avx2, beam_row_avx2 };
+		}
+		return { "sse2", erf_sse2, exp_sse2, gaussian_sse2, beam_row_sse2 };
+#elif defined(BEAM_MATH_NEON)
+		return { "neon", erf_neon, exp_neon, gaussian_neon, beam_row_neon };
+#else
+		return BeamMath::scalarKernels();
+#endif
+	}
+}
+
+float BeamMath::erf( float x ){
+	return erf1(x);
+}
+
+float BeamMath::exp( float x ){
+	return exp1(x);
+}
+
+float BeamMath::log( float x ){
+	return log1(x);
+}
+
+float BeamMath::gaussian( float x, float sigma ){
+	return exp1(-(x*x)*(1.0f/(2.0f*sigma*sigma)))*(1.0f/(TAUR*sigma));
+}
+
+const BeamMath::Kernels & BeamMath::kernels(){
+	static const Kernels k = pick_kernels();
+	return k;
+}
+
+const BeamMath::Kernels & BeamMath::scalarKernels(){
+	static const Kernels k = { "scalar", erf_scalar, exp_scalar, gaussian_scalar, beam_row_scalar };
+	return k;
+}
@@ -0,0 +1,64 @@
+//
+//  BeamMath.h
+//  Oscilloscope
+//
+//  The math of the beam: erf, exp and gaussians, as branch free polynomial
+//  approximations. shaders/beam.glsl has the same functions for the gpu, keep
+//  the two in sync. the app in check/ compares them.
+//
+//  Error bounds (measured against double precision, float inputs):
+//    erf       Abramowitz-Stegun 7.1.27, absolute error < 5e-4 (same as the shader)
+//    exp       range reduction to 2^n * e^r plus a degree 5 polynomial (cephes),
+//              relative error < 1e-7 for -87 < x < 88, clamped outside
+//    log       mantissa polynomial (cephes), absolute error < 1e-7 for x > 0
+//    gaussian  exp of a float argument, relative error ~1e-5 out at 8 sigma
+//
+//  The kernels work on arrays and are picked at runtime like AudioAlgo's
+//  (avx2, sse2, neon or scalar). The vector versions do the same operations in
+//  the same order as the scalar ones, so all of them give the same results
+//  (bit for bit, unless the compiler fuses the scalar multiply-adds).
+//
+
+#ifndef Oscilloscope_BeamMath_h
+#define Oscilloscope_BeamMath_h
+
+class BeamMath{
+public:
+	static float erf( float x );
+	static float exp( float x );
+	// natural log, x > 0
+	static float log( float x );
+	// normalized, like in osci.frag
+	static float gaussian( float x, float sigma );
+	
+	// everything osci.frag needs for one segment (see BeamRenderer)
+	struct Beam{
+		// length of the segment, 0 for a dot
+		float len;
+		// 1/(sqrt(2)*sigma) and 1/(2*sigma^2)
+		float invS;
+		float inv2s2;
+		// 0.5/sqrt(uSize) for dots, 0.5/len*uSize for lines
+		float scale;
+		// the alpha curve: pow(alpha, exponent)*gain
+		float exponent;
+		float gain;
+	};
+	
+	struct Kernels{
+		const char * name;
+		void (*erf)( float * destination, const float * source, int N );
+		void (*exp)( float * destination, const float * source, int N );
+		void (*gaussian)( float * destination, const float * source, float sigma, int N );
+		// the beam's alpha for a row of N pixels. the first pixel is at (x,y) in the
+		// segment's coordinates (along, across), every next one dx/dy further.
+		void (*beam_row)( float * alpha, float x, float dx, float y, float dy, const Beam & beam, int N );
+	};
+	
+	// fastest kernels for this cpu (avx2, sse2, neon or scalar)
+	static const Kernels & kernels();
+	// plain c++ kernels, mostly for comparison
+	static const Kernels & scalarKernels();
+};
+
+#endif
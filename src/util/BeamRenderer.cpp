@@ -0,0 +1,274 @@
+//
+//  BeamRenderer.cpp
+//  Oscilloscope
+//
+
+#include "BeamRenderer.h"
+#include "BeamMath.h"
+using namespace std;
+
+#define EPS 1E-6
+#define SQRT2 1.4142135623730951f
+
+// tiles are this many pixels wide and high
+#define BEAM_TILE_SIZE 64
+// below this many segments the threads cost more than they save
+#define BEAM_MIN_SEGMENTS_PER_THREAD 64
+
+namespace{
+	// the pixels of a row (centers at ix+0.5) where lo <= c + k*px <= hi
+	inline void narrow( float c, float k, float lo, float hi, int & ix0, int & ix1 ){
+		if( fabsf(k) < 1E-12 ){
+			if( c < lo || c > hi ) ix1 = ix0;
+			return;
+		}
+		float a = (lo - c)/k;
+		float b = (hi - c)/k;
+		if( a > b ) swap(a,b);
+		ix0 = MAX(ix0, (int)ceilf(a - 0.5f));
+		ix1 = MIN(ix1, (int)floorf(b - 0.5f) + 1);
+	}
+}
+
+BeamRenderer::BeamRenderer() :
+	width(0), height(0), numThreads(0), uSize(0.01f), uIntensity(0.4f), uHue(50), tilesX(0), tilesY(0), nextTile(0),
+	generation(0), activeWorkers(0), busyWorkers(0), quit(false){
+}
+
+BeamRenderer::~BeamRenderer(){
+	{
+		lock_guard<mutex> lock(workMutex);
+		quit = true;
+	}
+	workCondition.notify_all();
+	for( auto & worker : workers ){
+		worker.join();
+	}
+}
+
+void BeamRenderer::allocate( int width, int height ){
+	this->width = width;
+	this->height = height;
+	accum.assign(3*width*height, 0);
+	tilesX = (width + BEAM_TILE_SIZE - 1)/BEAM_TILE_SIZE;
+	tilesY = (height + BEAM_TILE_SIZE - 1)/BEAM_TILE_SIZE;
+	tiles.resize(tilesX*tilesY);
+}
+
+int BeamRenderer::getWidth(){
+	return width;
+}
+
+int BeamRenderer::getHeight(){
+	return height;
+}
+
+void BeamRenderer::setNumThreads( int numThreads ){
+	this->numThreads = numThreads;
+}
+
+void BeamRenderer::setSize( float uSize ){
+	this->uSize = uSize;
+}
+
+void BeamRenderer::setIntensity( float uIntensity ){
+	this->uIntensity = uIntensity;
+}
+
+void BeamRenderer::setHue( float uHue ){
+	this->uHue = uHue;
+}
+
+void BeamRenderer::clear(){
+	std::fill(accum.begin(), accum.end(), 0.0f);
+}
+
+void BeamRenderer::decay( float afterglow ){
+	for( float & v : accum ){
+		v *= afterglow;
+	}
+}
+
+const vector<float> & BeamRenderer::getAccumulation(){
+	return accum;
+}
+
+void BeamRenderer::resolve( ofPixels & pixels ){
+	pixels.allocate(width, height, OF_PIXELS_RGB);
+	unsigned char * out = pixels.getData();
+	for( size_t i = 0; i < accum.size(); i++ ){
+		float v = 1.0f - expf(-accum[i]);
+		out[i] = (unsigned char)ofClamp(v*255.0f + 0.5f, 0, 255);
+	}
+}
+
+void BeamRenderer::draw( const vector<ofVec3f> & points, const ofMatrix4x4 & matrix ){
+	int n = (int)points.size() - 1;
+	if( n < 1 || width == 0 || height == 0 ) return;
+	
+	// samples -> pixels is affine: pixel = o + ex*x + ey*y (top row first, like the screen)
+	ofVec3f ndcO = matrix.preMult(ofVec3f(0,0,0));
+	ofVec3f ndcX = matrix.preMult(ofVec3f(1,0,0));
+	ofVec3f ndcY = matrix.preMult(ofVec3f(0,1,0));
+	auto toPixels = [&]( ofVec3f ndc ){
+		return ofVec2f((ndc.x+1)*0.5f*width, (1-ndc.y)*0.5f*height);
+	};
+	ofVec2f o = toPixels(ndcO);
+	ofVec2f ex = toPixels(ndcX) - o;
+	ofVec2f ey = toPixels(ndcY) - o;
+	float det = ex.x*ey.y - ey.x*ex.y;
+	if( fabsf(det) < 1E-12 ) return;
+	// and back: sample = inv*(pixel - o)
+	float i00 = ey.y/det, i01 = -ey.x/det;
+	float i10 = -ex.y/det, i11 = ex.x/det;
+	
+	segments.resize(n);
+	for( auto & tile : tiles ) tile.clear();
+	
+	for( int i = 0; i < n; i++ ){
+		ofVec2f p0(points[i].x, points[i].y);
+		ofVec2f p1(points[i+1].x, points[i+1].y);
+		Segment & s = segments[i];
+		
+		// the same quad as addSegment() and osci_gpu.vert
+		ofVec2f dir = p1 - p0;
+		float z = dir.length();
+		if( z > EPS ) dir /= z;
+		else dir = ofVec2f(1.0, 0.0);
+		ofVec2f norm(-dir.y, dir.x);
+		s.len = z;
+		s.weight = points[i+1].z;
+		
+		// along = dir.(inv*(pixel-o) - p0), the same for across with norm
+		ofVec2f u(i00*dir.x + i10*dir.y, i01*dir.x + i11*dir.y);
+		ofVec2f v(i00*norm.x + i10*norm.y, i01*norm.x + i11*norm.y);
+		s.base = ofVec2f(-(u.x*o.x + u.y*o.y) - (p0.x*dir.x + p0.y*dir.y),
+		                 -(v.x*o.x + v.y*o.y) - (p0.x*norm.x + p0.y*norm.y));
+		s.ddx = ofVec2f(u.x, v.x);
+		s.ddy = ofVec2f(u.y, v.y);
+		
+		ofVec2f corners[4] = {
+			p0 - dir*uSize - norm*uSize, p0 - dir*uSize + norm*uSize,
+			p1 + dir*uSize - norm*uSize, p1 + dir*uSize + norm*uSize
+		};
+		float minX = width, minY = height, maxX = 0, maxY = 0;
+		for( ofVec2f & c : corners ){
+			ofVec2f px = o + ex*c.x + ey*c.y;
+			minX = MIN(minX, px.x); maxX = MAX(maxX, px.x);
+			minY = MIN(minY, px.y); maxY = MAX(maxY, px.y);
+		}
+		s.x0 = MAX(0, (int)floorf(minX));
+		s.y0 = MAX(0, (int)floorf(minY));
+		s.x1 = MIN(width, (int)ceilf(maxX)+1);
+		s.y1 = MIN(height, (int)ceilf(maxY)+1);
+		if( s.x0 >= s.x1 || s.y0 >= s.y1 || s.weight <= 0 ) continue;
+		
+		for( int ty = s.y0/BEAM_TILE_SIZE; ty <= (s.y1-1)/BEAM_TILE_SIZE; ty++ ){
+			for( int tx = s.x0/BEAM_TILE_SIZE; tx <= (s.x1-1)/BEAM_TILE_SIZE; tx++ ){
+				tiles[ty*tilesX + tx].push_back(i);
+			}
+		}
+	}
+	
+	// every thread takes the next tile until there are none left
+	int threads = numThreads > 0? numThreads : (int)std::thread::hardware_concurrency();
+	threads = MIN(threads, 1 + n/BEAM_MIN_SEGMENTS_PER_THREAD);
+	int helpers = MAX(0, threads-1);
+	{
+		lock_guard<mutex> lock(workMutex);
+		nextTile = 0;
+		// the pool only grows, helpers that aren't needed sit this batch out
+		while( (int)workers.size() < helpers ){
+			workers.emplace_back(&BeamRenderer::workerFunction, this, (int)workers.size(), generation);
+		}
+		activeWorkers = helpers;
+		busyWorkers = helpers;
+		generation++;
+	}
+	workCondition.notify_all();
+	
+	renderTiles();
+	
+	unique_lock<mutex> lock(workMutex);
+	doneCondition.wait(lock, [this]{ return busyWorkers == 0; });
+}
+
+void BeamRenderer::renderTiles(){
+	int t;
+	while( (t = nextTile++) < (int)tiles.size() ){
+		int tx0 = (t%tilesX)*BEAM_TILE_SIZE;
+		int ty0 = (t/tilesX)*BEAM_TILE_SIZE;
+		int tx1 = MIN(width, tx0 + BEAM_TILE_SIZE);
+		int ty1 = MIN(height, ty0 + BEAM_TILE_SIZE);
+		for( int i : tiles[t] ){
+			rasterize(segments[i], tx0, ty0, tx1, ty1);
+		}
+	}
+}
+
+// a helper thread. seen is the last batch it knows about.
+void BeamRenderer::workerFunction( int index, int seen ){
+	unique_lock<mutex> lock(workMutex);
+	while( true ){
+		workCondition.wait(lock, [&]{ return quit || generation != seen; });
+		if( quit ) return;
+		seen = generation;
+		if( index >= activeWorkers ) continue;
+		
+		lock.unlock();
+		renderTiles();
+		lock.lock();
+		if( --busyWorkers == 0 ){
+			doneCondition.notify_one();
+		}
+	}
+}
+
+// osci.frag for the pixels of one segment within one tile
+void BeamRenderer::rasterize( const Segment & s, int tx0, int ty0, int tx1, int ty1 ){
+	float sigma = uSize/(2.0f+2.0f*1000.0f*uSize/50.0f);
+	float intens = MAX(0.0f, uIntensity-0.4f)*0.7f - 1000.0f*uSize/500.0f;
+	float gain = (0.01f + MIN(0.99f, uIntensity*3.0f))*s.weight;
+	
+	// hsv2rgb(hue, 1, 1)
+	float h = uHue/360.0f;
+	float rgb[3];
+	float K[3] = {1.0f, 2.0f/3.0f, 1.0f/3.0f};
+	for( int c = 0; c < 3; c++ ){
+		float f = h + K[c];
+		rgb[c] = ofClamp(fabsf((f - floorf(f))*6.0f - 3.0f) - 1.0f, 0, 1);
+	}
+	
+	BeamMath::Beam beam;
+	bool dot = s.len < EPS;
+	beam.len = dot? 0 : s.len;
+	beam.invS = 1.0f/(SQRT2*sigma);
+	beam.inv2s2 = 1.0f/(2.0f*sigma*sigma);
+	beam.scale = dot? 0.5f/sqrtf(uSize) : 0.5f/s.len*uSize;
+	beam.exponent = 1.0f-intens;
+	beam.gain = gain;
+	const BeamMath::Kernels & k = BeamMath::kernels();
+	float alpha[BEAM_TILE_SIZE];
+	
+	for( int iy = MAX(s.y0, ty0); iy < MIN(s.y1, ty1); iy++ ){
+		float py = iy + 0.5f;
+		// only the pixels inside the quad
+		int ix0 = MAX(s.x0, tx0);
+		int ix1 = MIN(s.x1, tx1);
+		narrow(s.base.x + s.ddy.x*py, s.ddx.x, -uSize, s.len+uSize, ix0, ix1);
+		narrow(s.base.y + s.ddy.y*py, s.ddx.y, -uSize, uSize, ix0, ix1);
+		if( ix1 <= ix0 ) continue;
+		
+		float px = ix0 + 0.5f;
+		float x = s.base.x + s.ddx.x*px + s.ddy.x*py;
+		float y = s.base.y + s.ddx.y*px + s.ddy.y*py;
+		k.beam_row(alpha, x, s.ddx.x, y, s.ddx.y, beam, ix1 - ix0);
+		
+		float * out = &accum[3*(iy*width + ix0)];
+		for( int i = 0; i < ix1 - ix0; i++, out += 3 ){
+			out[0] += rgb[0]*alpha[i];
+			out[1] += rgb[1]*alpha[i];
+			out[2] += rgb[2]*alpha[i];
+		}
+	}
+}
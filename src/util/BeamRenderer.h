@@ -0,0 +1,99 @@
+//
+//  BeamRenderer.h
+//  Oscilloscope
+//
+//  The beam, rendered on the cpu. Same model as shaders/osci.frag (a gaussian
+//  beam integrated along each segment with erf), same quads, same blending into a
+//  float buffer, same afterglow and tone mapping as the hdr path (without the glow).
+//
+//  It needs no gl context, so it works where there is no gpu, and it's the
+//  reference to compare the shaders against.
+//
+//  The image is split into tiles. Every segment is sorted into the tiles its quad
+//  touches, then the tiles are rasterized in parallel, one thread per core, each
+//  thread owning the pixels of its tiles. The threads are started once and then
+//  wait for the next batch of tiles. Rows are evaluated in runs of pixels
+//  without branches so the compiler can vectorize them.
+//
+
+#ifndef Oscilloscope_BeamRenderer_h
+#define Oscilloscope_BeamRenderer_h
+
+#include "ofMain.h"
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class BeamRenderer{
+public:
+	BeamRenderer();
+	~BeamRenderer();
+	
+	// size of the image in pixels, clears it
+	void allocate( int width, int height );
+	int getWidth();
+	int getHeight();
+	// 0 uses all cores
+	void setNumThreads( int numThreads );
+	
+	// the uniforms of osci.frag
+	void setSize( float uSize );
+	void setIntensity( float uIntensity );
+	void setHue( float uHue );
+	
+	void clear();
+	// multiplies everything by afterglow, like the black rectangle over the fbo
+	void decay( float afterglow );
+	// draws the segments between consecutive points (x, y, weight, as they come out
+	// of the mesh builder), transformed by matrix to -1...1 like uMatrix does.
+	void draw( const std::vector<ofVec3f> & points, const ofMatrix4x4 & matrix );
+	
+	// the accumulated light, rgb floats, top row first
+	const std::vector<float> & getAccumulation();
+	// tone mapped like shaders/resolve.frag
+	void resolve( ofPixels & pixels );
+	
+private:
+	struct Segment{
+		// a pixel's position along and across the segment (osci.frag's color.xy)
+		// is base + ddx*px + ddy*py
+		ofVec2f base, ddx, ddy;
+		// in sample units, like the shader sees them
+		float len;
+		float weight;
+		// bounding box of the quad, in pixels
+		int x0, y0, x1, y1;
+	};
+	
+	void rasterize( const Segment & s, int tx0, int ty0, int tx1, int ty1 );
+	// takes tiles until there are none left
+	void renderTiles();
+	void workerFunction( int index, int seen );
+	
+	int width, height;
+	int numThreads;
+	float uSize, uIntensity, uHue;
+	
+	std::vector<float> accum;
+	std::vector<Segment> segments;
+	// segment indices, per tile
+	std::vector<std::vector<int>> tiles;
+	int tilesX, tilesY;
+	std::atomic<int> nextTile;
+	
+	// the helper threads, draw() renders on its own thread too
+	std::vector<std::thread> workers;
+	std::mutex workMutex;
+	std::condition_variable workCondition;
+	std::condition_variable doneCondition;
+	// counts the batches of tiles handed out
+	int generation;
+	// helpers wanted for the current batch, and those not done with it yet
+	int activeWorkers;
+	int busyWorkers;
+	bool quit;
+};
+
+#endif
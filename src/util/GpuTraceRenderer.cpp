@@ -0,0 +1,84 @@
+//
+//  GpuTraceRenderer.cpp
+//  Oscilloscope
+//
+
+#include "GpuTraceRenderer.h"
+using namespace std;
+
+// texture width in texels (one sample each). the height grows in powers of two.
+#define GPU_TRACE_TEXTURE_WIDTH 2048
+
+GpuTraceRenderer::GpuTraceRenderer() : numSegments(0){
+}
+
+void GpuTraceRenderer::draw( ofShader & shader, int trace, const vector<ofVec3f> & points ){
+	int n = (int)points.size() - 1;
+	if( n < 1 ) return;
+	
+	if( n > numSegments ){
+		allocateSegments(n);
+	}
+	
+	if( trace >= samples.size() ){
+		samples.resize(trace+1);
+	}
+	
+	// ofVec3f is three floats, so the points are already laid out as texels
+	int height = (points.size()+GPU_TRACE_TEXTURE_WIDTH-1)/GPU_TRACE_TEXTURE_WIDTH;
+	Samples & s = samples[trace];
+	ofTexture & tex = s.texture;
+	if( !tex.isAllocated() || s.height < height ){
+		s.height = 1;
+		while( s.height < height ) s.height *= 2;
+		tex.allocate(GPU_TRACE_TEXTURE_WIDTH, s.height, GL_RGB32F, false);
+		tex.setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
+	}
+	
+	// only the last row can be partial, the shader never reads past the last point
+	const float * data = &points[0].x;
+	int fullRows = points.size()/GPU_TRACE_TEXTURE_WIDTH;
+	int rest = points.size() - fullRows*GPU_TRACE_TEXTURE_WIDTH;
+	ofTextureData & texData = tex.getTextureData();
+	glBindTexture(texData.textureTarget, texData.textureID);
+	if( fullRows > 0 ){
+		glTexSubImage2D(texData.textureTarget, 0, 0, 0, GPU_TRACE_TEXTURE_WIDTH, fullRows, GL_RGB, GL_FLOAT, data);
+	}
+	if( rest > 0 ){
+		glTexSubImage2D(texData.textureTarget, 0, 0, fullRows, rest, 1, GL_RGB, GL_FLOAT, data + fullRows*GPU_TRACE_TEXTURE_WIDTH*3);
+	}
+	glBindTexture(texData.textureTarget, 0);
+	
+	shader.setUniformTexture("uSamples", tex, 1);
+	shader.setUniform2f("uSamplesSize", GPU_TRACE_TEXTURE_WIDTH, s.height);
+	quads.drawElements(GL_TRIANGLES, 6*n);
+}
+
+// corners are (segment, along, side), two triangles per segment
+void GpuTraceRenderer::allocateSegments( int numSegments ){
+	// grow in large steps, this is only rebuilt when a frame has more segments than ever before
+	int size = 4096;
+	while( size < numSegments ) size *= 2;
+	
+	vector<ofVec3f> corners(4*size);
+	vector<ofIndexType> indices(6*size);
+	for( int i = 0; i < size; i++ ){
+		ofVec3f * c = &corners[4*i];
+		c[0] = ofVec3f(i, 0, -1);
+		c[1] = ofVec3f(i, 0, +1);
+		c[2] = ofVec3f(i, 1, -1);
+		c[3] = ofVec3f(i, 1, +1);
+		
+		ofIndexType * idx = &indices[6*i];
+		idx[0] = 4*i+0;
+		idx[1] = 4*i+1;
+		idx[2] = 4*i+2;
+		idx[3] = 4*i+1;
+		idx[4] = 4*i+2;
+		idx[5] = 4*i+3;
+	}
+	
+	quads.setVertexData(corners.data(), corners.size(), GL_STATIC_DRAW);
+	quads.setIndexData(indices.data(), indices.size(), GL_STATIC_DRAW);
+	this->numSegments = size;
+}
@@ -0,0 +1,46 @@
+//
+//  GpuTraceRenderer.h
+//  Oscilloscope
+//
+//  Draws traces from their raw samples, the quads are built in the vertex shader
+//  (shaders/osci_gpu.vert).
+//
+//  The samples go into a float texture, one per texel (position and weight), which
+//  is all we upload per frame (12 bytes per sample instead of 168 for the six
+//  vertices+colors of a quad).
+//  The quads themselves come from a static buffer that only knows which segment,
+//  which end and which side each corner is. It is built once and only grows.
+//  Reading the samples with texture fetches instead of gl_VertexID, instancing or a
+//  geometry shader keeps this working on GL 2.1 cards (intel hd3000).
+//
+
+#ifndef Oscilloscope_GpuTraceRenderer_h
+#define Oscilloscope_GpuTraceRenderer_h
+
+#include "ofMain.h"
+#include <vector>
+
+class GpuTraceRenderer{
+public:
+	GpuTraceRenderer();
+	
+	// draws the segments between consecutive points, with the gpu shader bound.
+	// every trace keeps its own texture, so uploading the next trace doesn't wait for this one.
+	void draw( ofShader & shader, int trace, const std::vector<ofVec3f> & points );
+	
+private:
+	void allocateSegments( int numSegments );
+	
+	// the samples of one trace. loadData() would overwrite the texture's size with the
+	// size of the upload, so the allocated height is kept here.
+	struct Samples{
+		ofTexture texture;
+		int height{0};
+	};
+	
+	ofVbo quads;
+	int numSegments;
+	std::vector<Samples> samples;
+};
+
+#endif
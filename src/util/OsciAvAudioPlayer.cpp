@@ -12,20 +12,65 @@
 
 #include "OsciAvAudioPlayer.h"
 #include "Audio.h"
+#include "PcmCache.h"
+#include "PcmFile.h"
 extern "C"{
 	#include <libavutil/opt.h>
 }
 using namespace std;
 
-#define die(msg) { thread->unlock(); unloadSound(); cerr << msg << endl; return false; }
+#define die(msg) { close_file(file); cerr << msg << " (" << fileName << ")" << endl; return false; }
 
-OsciAvAudioPlayer::OsciAvAudioPlayer(){
+// sizes of the lock-free ring buffers between decoder, audio callback and renderer.
+// they limit how far the decoder can read ahead.
+#define MAIN_OUT_CAPACITY (1<<18)
+#define VISUAL_PENDING_CAPACITY (1<<20)
+#define VISUAL_OUT_CAPACITY (1<<18)
+
+// the decoder thread sleeps until it's woken up, but never longer than this (see WakeSignal)
+#define DECODER_MAX_SLEEP_MS 5
+
+// frames per block when the cache has to be resampled to the output rate
+#define CACHE_RESAMPLE_BLOCK 1024
+
+// seeks start decoding this much earlier, so codecs with some warm up (mp3, aac) are settled at the target
+#define SEEK_PREROLL_MS 100
+
+OsciAvAudioPlayer::OsciAvAudioPlayer() :
+	mainOut(MAIN_OUT_CAPACITY),
+	stereo192(VISUAL_OUT_CAPACITY),
+	pending192(VISUAL_PENDING_CAPACITY){
 	// default audio settings
+	isLoaded = false;
+	isPlaying = false;
+	thread = NULL;
+	cache = new PcmCache();
+	cache_active = false;
+	cache_swr_context = NULL;
+	cache_position = 0;
+	cache_resync = true;
+	cache_buffer_pos = 0;
+	cache_buffer_len = 0;
+	output_position = 0;
+	wrap_length = 0;
+	seek_skip_to = -1;
 	output_expected_buffer_size = 256;
+	read_ahead_ms = 0;
+	visual_read_ahead_ms = 0;
+	visual_release_remainder = 0;
+	underrunCount = 0;
 	output_channel_layout = av_get_default_channel_layout(2);
 	output_sample_rate = 44100;
 	visual_sample_rate = 192000;
 	visual_config_changed = false;
+	visual_mode = VISUAL_FROM_SOURCE;
+	num_visual_pairs = 1;
+	for( int i = 0; i < VISUAL_MAX_PAIRS; i++ ){
+		visual_pairs[i] = NULL;
+		pending_pairs[i] = NULL;
+	}
+	visual_pairs[0] = &stereo192;
+	pending_pairs[0] = &pending192;
 	output_num_channels = 2;
 	output_config_changed = false; 
 	volume = 1;
@@ -36,108 +81,317 @@ OsciAvAudioPlayer::OsciAvAudioPlayer(){
 	isLooping = false;
 	container = NULL; 
 	decoded_frame = NULL;
+	frame_pending = false;
+	decoder_flushed = false;
+	decoded_buffer_frame = 0;
+	batch_pts = AV_NOPTS_VALUE;
+	batch_data = NULL;
+	batch_len = 0;
+	batch_capacity = 0;
 	codec_context = NULL;
+	pcm_file = NULL;
+	pcm_position = 0;
 	buffer_size = AVCODEC_MAX_AUDIO_FRAME_SIZE;
 	swr_context = NULL;
 	swr_context192 = NULL;
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58,9,100)
 	av_register_all();
+#endif
 	av_init_packet(&packet);
 	unloadSound();
-	
-	thread = NULL;
 }
 
 OsciAvAudioPlayer::~OsciAvAudioPlayer(){
+	clearQueue();
 	unloadSound();
 	if( thread != NULL ){
 		thread->stopThread();
+		thread->wake();
+		thread->waitForThread(false);
+		delete thread;
 		thread = NULL;
 	}
+	delete cache;
+	if( cache_swr_context ){
+		swr_free(&cache_swr_context);
+	}
+	for( int i = 1; i < VISUAL_MAX_PAIRS; i++ ){
+		delete visual_pairs[i];
+		delete pending_pairs[i];
+	}
 }
 
 bool OsciAvAudioPlayer::loadSound(string fileName, bool stream){
+	start_thread();
+	unloadSound();
+	
+	OpenFile file;
+	if( !open_file(ofToDataPath(fileName,true), file) ){
+		return false;
+	}
+	
+	thread->lock();
+	bool res = install_file(file);
+	thread->unlock();
+	thread->wake();
+	
+	return res;
+}
+
+void OsciAvAudioPlayer::loadSoundAsync(string fileName){
+	start_thread();
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		load_request = ofToDataPath(fileName,true);
+	}
+	thread->wake();
+}
+
+void OsciAvAudioPlayer::start_thread(){
+	lock_guard<mutex> lock(queue_mutex);
 	if( thread == NULL ){
 		thread = new OsciAvAudioPlayerThread(*this);
 		thread->startThread(); 
 	}
+}
+
+// replaces whatever is playing with an opened file.
+// call with the thread locked
+bool OsciAvAudioPlayer::install_file( OpenFile & file ){
+	if( isLoaded ){
+		close_current();
+	}
 	
-	unloadSound();
-	thread->lock();
+	// from here on it's mostly following
+	// https://github.com/FFmpeg/FFmpeg/blob/master/doc/examples/decode_audio.c
+	decoded_frame = av_frame_alloc();
+	if( decoded_frame == NULL ){
+		close_file(file);
+		cerr << "Could not allocate audio frame" << endl;
+		return false;
+	}
+	
+	use_file(file);
 	
-	string fileNameAbs = ofToDataPath(fileName,true);
-	const char * input_filename = fileNameAbs.c_str();
+	if( forceNativeFormat ){
+		output_sample_rate = input_sample_rate();
+		output_channel_layout = pcm_file == NULL? codec_context->channel_layout : 0;
+		if( output_channel_layout == 0 ){
+			output_num_channels = pcm_file == NULL? codec_context->channels : pcm_file->getNumChannels();
+			output_channel_layout = av_get_default_channel_layout(output_num_channels);
+		}
+		else{
+			output_num_channels = av_get_channel_layout_nb_channels( output_channel_layout );
+		}
+		cout << "native audio thing: " << output_sample_rate << "Hz / " << output_num_channels << " channels" << endl;
+	}
+	
+	wrap_length = 0;
+	swr_context = NULL;
+	swr_context192 = NULL;
+	isLoaded = true;
+	isPlaying = true;
+
+	// we continue here:
+	decode_next_frame();
+	startCache();
+	
+	return true;
+}
+
+// opens the container and the codec, without touching the player's state.
+// this is the slow part of loading a file, so the playlist does it ahead of time.
+bool OsciAvAudioPlayer::open_file( string fileName, OpenFile & file ){
+	close_file(file);
+	file.fileName = fileName;
+	
+	// plain wav/aiff files are read directly, everything else goes through libav
+	file.pcm = new PcmFile();
+	if( file.pcm->open(fileName) ){
+		return true;
+	}
+	delete file.pcm;
+	file.pcm = NULL;
+	
+	const char * input_filename = fileName.c_str();
 	// the first finds the right codec, following  https://blinkingblip.wordpress.com/2011/10/08/decoding-and-playing-an-audio-stream-using-libavcodec-libavformat-and-libao/
-	container = 0;
-	if (avformat_open_input(&container, input_filename, NULL, NULL) < 0) {
+	if (avformat_open_input(&file.container, input_filename, NULL, NULL) < 0) {
+		file.container = NULL;
 		die("Could not open file");
 	}
  
-	if (avformat_find_stream_info(container,NULL) < 0) {
+	if (avformat_find_stream_info(file.container,NULL) < 0) {
 		die("Could not find file info");
 	}
  
-	audio_stream_id = -1;
- 
 	// To find the first audio stream. This process may not be necessary
 	// if you can gurarantee that the container contains only the desired
 	// audio stream
-	int i;
-	for (i = 0; i < container->nb_streams; i++) {
-		if (container->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO) {
-			audio_stream_id = i;
+	file.audio_stream_id = -1;
+	for (int i = 0; i < file.container->nb_streams; i++) {
+		if (file.container->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+			file.audio_stream_id = i;
 			break;
 		}
 	}
  
-	if (audio_stream_id == -1) {
+	if (file.audio_stream_id == -1) {
 		die("Could not find an audio stream");
 	}
  
 	// Find the apropriate codec and open it
-	codec_context = container->streams[audio_stream_id]->codec;
-	if( forceNativeFormat ){
-		output_sample_rate = codec_context->sample_rate;
-		output_channel_layout = codec_context->channel_layout;
-		if( output_channel_layout == 0 ){
-			output_num_channels = codec_context->channels;
-			output_channel_layout = av_get_default_channel_layout(output_num_channels);
-		}
-		else{
-			output_num_channels = av_get_channel_layout_nb_channels( output_channel_layout );
-		}
-		cout << "native audio thing: " << output_sample_rate << "Hz / " << output_num_channels << " channels" << endl;
+	AVStream * audio_stream = file.container->streams[file.audio_stream_id];
+	AVCodec* codec = avcodec_find_decoder(audio_stream->codecpar->codec_id);
+	if( codec == NULL ){
+		die("Could not find the needed codec");
+	}
+	
+	file.codec_context = avcodec_alloc_context3(codec);
+	if( file.codec_context == NULL || avcodec_parameters_to_context(file.codec_context, audio_stream->codecpar) < 0 ){
+		die("Could not allocate the codec context");
 	}
+	file.codec_context->pkt_timebase = audio_stream->time_base;
 	
-	AVCodec* codec = avcodec_find_decoder(codec_context->codec_id);
-	if (avcodec_open2(codec_context, codec,NULL)) {
+	if (avcodec_open2(file.codec_context, codec,NULL)) {
 		die("Could not find open the needed codec");
 	}
 	
-	// from here on it's mostly following
-	// https://github.com/FFmpeg/FFmpeg/blob/master/doc/examples/decoding_encoding.c
-	//packet.data = inbuf;
-	//packet.size = fread(inbuf, 1, AVCODEC_AUDIO_INBUF_SIZE, f);
+	return true;
+}
+
+void OsciAvAudioPlayer::close_file( OpenFile & file ){
+	if( file.codec_context ){
+		avcodec_free_context(&file.codec_context);
+		file.codec_context = NULL;
+	}
+	if( file.container ){
+		avformat_close_input(&file.container);
+		file.container = NULL;
+	}
+	delete file.pcm;
+	file.pcm = NULL;
+	file.audio_stream_id = -1;
+	file.fileName = "";
+}
+
+// makes an opened file the current one. the player's own file must be closed already.
+// call with the thread locked
+void OsciAvAudioPlayer::use_file( OpenFile & file ){
+	container = file.container;
+	codec_context = file.codec_context;
+	audio_stream_id = file.audio_stream_id;
+	pcm_file = file.pcm;
+	pcm_position = 0;
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		file_name = file.fileName;
+	}
+	file.container = NULL;
+	file.codec_context = NULL;
+	file.pcm = NULL;
+	close_file(file);
+	
+	av_packet_unref(&packet);
 	av_init_packet(&packet);
 	packet.data = NULL;
 	packet.size = 0;
+	
+	frame_pending = false;
+	decoder_flushed = false;
+	decoded_buffer_frame = 0;
+	output_position = 0;
+	seek_skip_to = -1;
+	int channels = pcm_file == NULL? codec_context->channels : pcm_file->getNumChannels();
+	isMonoFile = channels == 1;
+	set_visual_pairs( channels >= 4? MIN(channels/2, VISUAL_MAX_PAIRS) : 1 );
+	if( pcm_file == NULL ){
+		duration = av_time_to_millis(container->streams[audio_stream_id]->duration);
+	}
+	else{
+		duration = pcm_file->getNumFrames()*1000/pcm_file->getSampleRate();
+	}
+}
 
-	swr_context = NULL;
-	swr_context192 = NULL;
-	isLoaded = true;
-	isPlaying = true;
-	isMonoFile = codec_context->channels == 1;
-
-	// we continue here:
-	decode_next_frame();
-	duration = av_time_to_millis(container->streams[audio_stream_id]->duration);
+// opens the next file in the playlist, unless that's done already.
+// call with the thread locked
+void OsciAvAudioPlayer::prepare_next_file(){
+	while( !next_file.isOpen() ){
+		string fileName;
+		{
+			lock_guard<mutex> lock(queue_mutex);
+			if( queue.empty() ) return;
+			fileName = queue.front();
+			queue.pop_front();
+		}
+		open_file(fileName, next_file);
+	}
+}
 
-	thread->unlock();
+// called at the end of the current file. continues with the next file in the playlist,
+// the decoder simply carries on, so there's no gap and no click.
+// returns false if there is nothing to play next.
+// call with the thread locked
+bool OsciAvAudioPlayer::switch_to_next_file(){
+	// normally the decoder thread has done this long ago
+	prepare_next_file();
+	if( !next_file.isOpen() ){
+		return false;
+	}
+	
+	if( isLooping ){
+		lock_guard<mutex> lock(queue_mutex);
+		queue.push_back(file_name);
+	}
+	
+	if( cache_active ){
+		// the decoder was left somewhere in the middle of the file, nothing of that is wanted
+		visual_upsampler.reset();
+		cache_active = false;
+	}
+	cache->cancel();
+	decoded_buffer_len = 0;
+	decoded_buffer_pos = 0;
+	
+	avcodec_free_context(&codec_context);
+	avformat_close_input(&container);
+	codec_context = NULL;
+	container = NULL;
+	delete pcm_file;
+	pcm_file = NULL;
+	
+	// the resamplers are kept, so their delay lines run straight into the next file
+	wrap_length = output_position;
+	use_file(next_file);
+	startCache();
 	
 	return true;
 }
 
 bool OsciAvAudioPlayer::setupAudioOut( int numChannels, int sampleRate, bool inter ){
 	if( numChannels != output_num_channels || sampleRate != output_sample_rate || inter != interpolate ){
+		if( thread != NULL ) thread->lock();
+		// the cache is kept at the file's own rate and only resampled on the way out,
+		// so it only has to be decoded again for a different number of channels
+		bool restartCache = numChannels != output_num_channels;
+		if( restartCache ){
+			stopCache();
+		}
+		
+		if( sampleRate != output_sample_rate ){
+			// positions are counted in output frames
+			output_position = output_position*sampleRate/output_sample_rate;
+			decoded_buffer_frame = decoded_buffer_frame*sampleRate/output_sample_rate;
+			if( next_seekTarget >= 0 ) next_seekTarget = next_seekTarget*sampleRate/output_sample_rate;
+			if( seek_skip_to >= 0 ) seek_skip_to = seek_skip_to*sampleRate/output_sample_rate;
+			cache_resync = true;
+			
+			if( cache_active && max(192000,sampleRate) != cache->getVisualSampleRate() ){
+				// the render rate goes up with it, that's not in the cache
+				cache_active = false;
+				next_seekTarget = output_position;
+			}
+		}
+		
 		output_channel_layout = av_get_default_channel_layout(numChannels);
 		output_sample_rate = sampleRate;
 		output_num_channels = numChannels;
@@ -146,15 +400,57 @@ bool OsciAvAudioPlayer::setupAudioOut( int numChannels, int sampleRate, bool int
 		if( swr_context != NULL ){
 			output_config_changed = true;
 		}
+		
+		if( restartCache ){
+			startCache();
+		}
+		if( thread != NULL ) thread->unlock();
 	}
 	
 	return true;
 }
 
+void OsciAvAudioPlayer::setDecodeCacheSize( size_t maxBytes ){
+	cache->setMemoryLimit(maxBytes);
+}
+
+void OsciAvAudioPlayer::setDiskCache( std::string directory, size_t maxBytes ){
+	cache->setDiskCache(directory, maxBytes);
+}
+
+bool OsciAvAudioPlayer::isCached(){
+	return cache_active;
+}
+
+int OsciAvAudioPlayer::getVisualSampleRate(){
+	return visual_sample_rate;
+}
+
+// call with the thread locked
+void OsciAvAudioPlayer::startCache(){
+	if( isLoaded && cache->isEnabled() && output_num_channels == 2 && num_visual_pairs == 1 && !forceNativeFormat ){
+		cache->start(file_name, input_sample_rate());
+	}
+}
+
+// call with the thread locked
+void OsciAvAudioPlayer::stopCache(){
+	if( cache_active ){
+		// the decoder takes over again where the cache was
+		cache_active = false;
+		next_seekTarget = output_position;
+	}
+	cache->cancel();
+}
+
 bool OsciAvAudioPlayer::setupVisualSampleRate( int visualSampleRate ){
 	if( visualSampleRate != visual_sample_rate ){
+		if( thread != NULL ) thread->lock();
+		stopCache();
 		visual_sample_rate = visualSampleRate;
 		visual_config_changed = true;
+		startCache();
+		if( thread != NULL ) thread->unlock();
 	}
 	return true; 
 }
@@ -164,25 +460,43 @@ bool OsciAvAudioPlayer::setupVisualSampleRate( int visualSampleRate ){
 void OsciAvAudioPlayer::unloadSound(){
 	if( !isLoaded ) return;
 	thread->lock();
-	
-	len = 0;
+	close_current();
+	thread->unlock();
+}
+
+// call with the thread locked
+void OsciAvAudioPlayer::close_current(){
+	cache->cancel();
+	cache_active = false;
 	isLoaded = false;
 	isPlaying = false;
-	packet_data_size = 0;
 	decoded_buffer_pos = 0;
 	decoded_buffer_len = 0;
 	next_seekTarget = -1;
 
-	av_free_packet(&packet);
+	av_packet_unref(&packet);
 	
 	if( decoded_frame ){
 		av_frame_unref(decoded_frame);
 		av_frame_free(&decoded_frame);
 		decoded_frame = NULL;
 	}
+	frame_pending = false;
+	
+	if( batch_data ){
+		av_freep(&batch_data[0]);
+		av_freep(&batch_data);
+		batch_data = NULL;
+	}
+	batch_len = 0;
+	batch_capacity = 0;
+	
+	if( codec_context ){
+		avcodec_free_context(&codec_context);
+		codec_context = NULL;
+	}
 	
 	if( container ){
-		avcodec_close(codec_context);
 		avformat_close_input(&container);
 		avformat_free_context(container);
 		av_free(container); 
@@ -190,6 +504,9 @@ void OsciAvAudioPlayer::unloadSound(){
 		codec_context = NULL;
 	}
 	
+	delete pcm_file;
+	pcm_file = NULL;
+	
 	if( swr_context ){
 		swr_close(swr_context);
 		swr_free(&swr_context);
@@ -202,41 +519,66 @@ void OsciAvAudioPlayer::unloadSound(){
 		swr_context192 = NULL;
 	}
 	
-	left192.clear();
-	right192.clear();
-	
-	thread->unlock();
+	clearQueues();
 }
 
 OsciAvAudioPlayerThread::OsciAvAudioPlayerThread( OsciAvAudioPlayer & player ) : player(player), isAsync(true){
 }
 
+void OsciAvAudioPlayerThread::wake(){
+	wakeSignal.wake();
+}
+
 void OsciAvAudioPlayerThread::threadedFunction(){
-	// make sure we always have a bit of buffer ready
 	while( isThreadRunning() ){
+		// sleep until the audio callback (or a seek, load, etc.) asks for more data
+		if( !wakeSignal.wait(DECODER_MAX_SLEEP_MS) ){
+			continue;
+		}
+		
+		// a file to load? it's opened before taking the lock, so the current file plays on meanwhile
+		string loadName = player.take_load_request();
+		if( loadName != "" ){
+			OsciAvAudioPlayer::OpenFile file;
+			bool success = player.open_file(loadName, file);
+			if( success ){
+				lock();
+				success = player.install_file(file);
+				unlock();
+			}
+			OsciAvAudioPlayer::LoadEventArgs args{loadName, success};
+			ofNotifyEvent(player.loadEvent, args);
+		}
+		
 		lock();
 		if( player.wantsAsync ){
 			isAsync = true;
 			if( player.next_seekTarget >= 0 ){
-				player.mainOut.clear();
-				player.left192.clear();
-				player.right192.clear();
+				player.clearQueues();
 			}
-			if( player.mainOut.totalLength < player.output_expected_buffer_size*4 && player.isLoaded ){
-				float * buffer = new float[player.output_expected_buffer_size*2];
-				int numSamples = player.internalAudioOut(buffer, player.output_expected_buffer_size, 2);
-				if( numSamples > 0 ){
-					player.mainOut.append( buffer, 2*numSamples );
-				}
-				delete buffer;
+			
+			// top up to the high water mark in one go
+			int blockSize = player.output_expected_buffer_size;
+			int highWater = player.highWaterFrames();
+			int visualHighWater = player.visualHighWaterFrames();
+			if( (int)refillBuffer.size() < 2*blockSize ){
+				refillBuffer.resize(2*blockSize);
+			}
+			while( player.isLoaded && player.mainOut.totalLength < 2*highWater && player.pending192.totalLength < visualHighWater ){
+				int numSamples = player.internalAudioOut(refillBuffer.data(), blockSize, 2);
+				if( numSamples <= 0 ) break;
+				player.mainOut.append( refillBuffer.data(), 2*numSamples );
+			}
+			
+			// open the next file of the playlist while this one plays
+			if( player.isLoaded ){
+				player.prepare_next_file();
 			}
 		}
 		else{
 			isAsync = false;
 		}
 		unlock();
-		sleep(1);
-		yield();
 	}
 }
 
@@ -253,8 +595,19 @@ int OsciAvAudioPlayer::audioOut(float *output, int bufferSize, int nChannels){
 			mainOut.play();
 			int res = mainOut.addTo(output, 1, 2*bufferSize);
 			mainOut.peel(res);
+			releaseVisual(res/2);
+			if( mainOut.totalLength < 2*lowWaterFrames() ){
+				thread->wake();
+			}
+			if( res < 2*bufferSize && isPlaying ){
+				underrunCount ++;
+			}
 			return res;
 		}
+		if( thread != NULL ){
+			if( isPlaying ) underrunCount ++;
+			thread->wake();
+		}
 		return 0;
 	}
 	else{
@@ -262,6 +615,88 @@ int OsciAvAudioPlayer::audioOut(float *output, int bufferSize, int nChannels){
 	}
 }
 
+// the render stream is decoded together with the main stream, but we only
+// pass it on to the renderer once the matching audio is played.
+// otherwise the picture would run ahead of the sound by the read-ahead.
+void OsciAvAudioPlayer::releaseVisual( int frames ){
+	int64_t total = (int64_t)frames*visual_sample_rate + visual_release_remainder;
+	int N = (int)(total/output_sample_rate);
+	visual_release_remainder = total - (int64_t)N*output_sample_rate;
+	
+	int pairs = num_visual_pairs;
+	for( int p = 0; p < pairs; p++ ){
+		MonoSample::Span left, right;
+		pending_pairs[p]->peekSpan(N, left, right);
+		for( int i = 0; i < 2; i++ ){
+			visual_pairs[p]->append(left.data[i], right.data[i], left.length[i]);
+		}
+		pending_pairs[p]->consume(left.size());
+	}
+}
+
+void OsciAvAudioPlayer::clearQueues(){
+	mainOut.clear();
+	int pairs = num_visual_pairs;
+	for( int p = 0; p < pairs; p++ ){
+		pending_pairs[p]->clear();
+		visual_pairs[p]->clear();
+	}
+}
+
+// call with the thread locked
+void OsciAvAudioPlayer::set_visual_pairs( int pairs ){
+	if( pairs == num_visual_pairs ) return;
+	for( int p = 1; p < pairs; p++ ){
+		if( visual_pairs[p] == NULL ){
+			visual_pairs[p] = new StereoSample(VISUAL_OUT_CAPACITY);
+			pending_pairs[p] = new StereoSample(VISUAL_PENDING_CAPACITY);
+		}
+		visual_pairs[p]->clear();
+		pending_pairs[p]->clear();
+	}
+	decoded_pairs192.resize(pairs-1);
+	for( vector<float> & buffer : decoded_pairs192 ){
+		buffer.resize(AVCODEC_MAX_AUDIO_FRAME_SIZE);
+	}
+	num_visual_pairs = pairs;
+	
+	// the main output and the render stream are wired differently now
+	output_config_changed = true;
+	visual_config_changed = true;
+}
+
+void OsciAvAudioPlayer::setReadAheadMS( int mainMS, int visualMS ){
+	read_ahead_ms = mainMS;
+	visual_read_ahead_ms = visualMS;
+}
+
+int OsciAvAudioPlayer::getQueuedMS(){
+	return (mainOut.totalLength/2)*1000LL/output_sample_rate;
+}
+
+int OsciAvAudioPlayer::getVisualQueuedMS(){
+	return pending192.totalLength*1000LL/visual_sample_rate;
+}
+
+int OsciAvAudioPlayer::lowWaterFrames(){
+	return highWaterFrames()/2;
+}
+
+int OsciAvAudioPlayer::highWaterFrames(){
+	int highWater = read_ahead_ms > 0? (int)(read_ahead_ms*(int64_t)output_sample_rate/1000) : output_expected_buffer_size*4;
+	// at least a few blocks, and leave room for the last block in the ring buffer
+	highWater = MAX(highWater, output_expected_buffer_size*2);
+	return MIN(highWater, MAIN_OUT_CAPACITY/2 - output_expected_buffer_size);
+}
+
+int OsciAvAudioPlayer::visualHighWaterFrames(){
+	// at least as much as two audio blocks need, otherwise the decoder would starve the main stream
+	int64_t minFrames = 2LL*output_expected_buffer_size*visual_sample_rate/output_sample_rate;
+	int64_t highWater = visual_read_ahead_ms > 0? visual_read_ahead_ms*(int64_t)visual_sample_rate/1000 : 4*minFrames;
+	highWater = MAX(highWater, minFrames);
+	return (int)MIN(highWater, (int64_t)VISUAL_PENDING_CAPACITY/2);
+}
+
 int OsciAvAudioPlayer::audioOutSync(float *output, int bufferSize, int nChannels){
 	return internalAudioOut(output, bufferSize, nChannels);
 }
@@ -269,15 +704,25 @@ int OsciAvAudioPlayer::audioOutSync(float *output, int bufferSize, int nChannels
 int OsciAvAudioPlayer::internalAudioOut(float *output, int bufferSize, int nChannels){
 	if( !isLoaded ){ return 0; }
 	
+	if( !cache_active && cache->isComplete() && cache->getVisualSampleRate() == visual_sample_rate ){
+		// the whole file is decoded now, continue from there where the decoder is
+		cache_active = true;
+		cache_resync = true;
+	}
+	
+	if( cache_active ){
+		return cachedAudioOut(output, bufferSize, nChannels);
+	}
+	
 	if( next_seekTarget >= 0 ){
-		mainOut.clear();
-		left192.clear();
-		right192.clear();
-		//av_seek_frame(container,-1,next_seekTarget,AVSEEK_FLAG_ANY);
-		avformat_seek_file(container,audio_stream_id,0,next_seekTarget,next_seekTarget,AVSEEK_FLAG_ANY);
+		clearQueues();
+		seek_decoder(next_seekTarget);
+		output_position = next_seekTarget;
+		// whatever is still queued is dropped, it doesn't belong before the new position
+		wrap_length = 0;
 		next_seekTarget = -1;
-		avcodec_flush_buffers(codec_context);
-		decode_next_frame();
+		// decode up to the exact sample
+		while( decode_next_frame() && skip_to_seek_target() );
 	}
 	
 	if( !isPlaying ){ return 0; }
@@ -311,6 +756,7 @@ int OsciAvAudioPlayer::internalAudioOut(float *output, int bufferSize, int nChan
 			
 			decoded_buffer_pos += samples;
 			num_samples_read += samples;
+			output_position += samples/nChannels;
 			
 			// find copy points in 192k buffer
 			int a = (decoded_buffer_pos-samples)*(long)visual_sample_rate/output_sample_rate;
@@ -318,8 +764,11 @@ int OsciAvAudioPlayer::internalAudioOut(float *output, int bufferSize, int nChan
 			a = a - (a%2);
 			b = MIN(b - (b%2), decoded_buffer_len192);
 			if( b-a > 0 ){
-				left192.append( decoded_buffer192+a, (b-a)/2, 2 );
-				right192.append( decoded_buffer192+1+a, (b-a)/2, 2 );
+				// when exporting there is no audio callback, so the renderer gets everything right away
+				for( int p = 0; p < num_visual_pairs; p++ ){
+					StereoSample &visualOut = wantsAsync? *pending_pairs[p] : *visual_pairs[p];
+					visualOut.append( (p == 0? decoded_buffer192 : decoded_pairs192[p-1].data())+a, (b-a)/2 );
+				}
 			}
 		}
 		
@@ -334,142 +783,511 @@ int OsciAvAudioPlayer::internalAudioOut(float *output, int bufferSize, int nChan
 	return num_samples_read/nChannels;
 }
 
+// same as internalAudioOut, but reads from the decode cache
+int OsciAvAudioPlayer::cachedAudioOut(float *output, int bufferSize, int nChannels){
+	if( next_seekTarget >= 0 ){
+		clearQueues();
+		output_position = next_seekTarget;
+		wrap_length = 0;
+		next_seekTarget = -1;
+		cache_resync = true;
+	}
+	
+	if( !isPlaying ){ return 0; }
+	
+	if( cache_resync ){
+		cache_resync = false;
+		int cacheRate = cache->getSampleRate();
+		cache_position = output_position*cacheRate/output_sample_rate;
+		cache_buffer_pos = 0;
+		cache_buffer_len = 0;
+		if( cache_swr_context ){
+			swr_free(&cache_swr_context);
+		}
+		if( cacheRate != output_sample_rate ){
+			cache_swr_context = swr_alloc_set_opts(NULL,
+												   av_get_default_channel_layout(2), AV_SAMPLE_FMT_FLT, output_sample_rate,
+												   av_get_default_channel_layout(2), AV_SAMPLE_FMT_FLT, cacheRate,
+												   0, NULL);
+			if( !cache_swr_context || swr_init(cache_swr_context) < 0 ){
+				fprintf(stderr, "Could not allocate cache resampler context\n");
+				swr_free(&cache_swr_context);
+				// let the decoder deal with it
+				cache_active = false;
+				next_seekTarget = output_position;
+				return internalAudioOut(output, bufferSize, nChannels);
+			}
+			cache_input.resize(2*CACHE_RESAMPLE_BLOCK);
+			// plus some room for what the resampler holds back
+			cache_buffer.resize(2*(CACHE_RESAMPLE_BLOCK*(int64_t)output_sample_rate/cacheRate + 256));
+		}
+	}
+	
+	StereoSample &visualOut = wantsAsync? pending192 : stereo192;
+	int num_frames_read = 0;
+	while( num_frames_read < bufferSize ){
+		int N = read_cache(output+num_frames_read*nChannels, bufferSize-num_frames_read);
+		if( N > 0 ){
+			if( volume != 1 ){
+				AudioAlgo::scale(output+num_frames_read*nChannels, volume, N*nChannels);
+			}
+			
+			// and the matching part of the render stream
+			int64_t a = output_position*visual_sample_rate/output_sample_rate;
+			int64_t b = (output_position+N)*visual_sample_rate/output_sample_rate;
+			int M = cache->readVisual(a, decoded_buffer192, (int)MIN(b-a, (int64_t)AVCODEC_MAX_AUDIO_FRAME_SIZE/2));
+			visualOut.append(decoded_buffer192, M);
+			
+			output_position += N;
+			num_frames_read += N;
+		}
+		
+		if( num_frames_read < bufferSize ){
+			if( switch_to_next_file() ){
+				// the decoder takes over with the next file
+				return num_frames_read + internalAudioOut(output+num_frames_read*nChannels, bufferSize-num_frames_read, nChannels);
+			}
+			else if( isLooping && output_position > 0 ){
+				wrap_length = output_position;
+				output_position = 0;
+				cache_resync = true;
+				return num_frames_read + cachedAudioOut(output+num_frames_read*nChannels, bufferSize-num_frames_read, nChannels);
+			}
+			else{
+				isPlaying = false;
+				break;
+			}
+		}
+	}
+	
+	return num_frames_read;
+}
+
+// copies up to N frames from the cache, resampled to the output rate if needed.
+// returns fewer only at the end of the file.
+int OsciAvAudioPlayer::read_cache( float * output, int N ){
+	if( cache_swr_context == NULL ){
+		int M = cache->readMain(cache_position, output, N);
+		cache_position += M;
+		return M;
+	}
+	
+	int num_frames_read = 0;
+	while( num_frames_read < N ){
+		if( cache_buffer_pos == cache_buffer_len ){
+			int M = cache->readMain(cache_position, cache_input.data(), CACHE_RESAMPLE_BLOCK);
+			cache_position += M;
+			// without input the resampler hands out what it still holds
+			const uint8_t * in = (const uint8_t*)cache_input.data();
+			uint8_t * out = (uint8_t*)cache_buffer.data();
+			int converted = swr_convert(cache_swr_context, &out, (int)cache_buffer.size()/2, M > 0? &in : NULL, M);
+			cache_buffer_pos = 0;
+			cache_buffer_len = 2*max(0,converted);
+			if( converted <= 0 ) break;
+		}
+		
+		int frames = MIN(N-num_frames_read, (cache_buffer_len-cache_buffer_pos)/2);
+		memcpy(output+2*num_frames_read, cache_buffer.data()+cache_buffer_pos, 2*frames*sizeof(float));
+		cache_buffer_pos += 2*frames;
+		num_frames_read += frames;
+	}
+	
+	return num_frames_read;
+}
+
 bool OsciAvAudioPlayer::decode_next_frame(){
-	av_free_packet(&packet);
-	int res = av_read_frame(container, &packet);
-	bool didRead = res >= 0;
-	
-	if( didRead ){
-		int got_frame = 0;
-		if (!decoded_frame) {
-			if (!(decoded_frame = av_frame_alloc())) {
-				fprintf(stderr, "Could not allocate audio frame\n");
-				return false;
+	// collect whatever the decoder produces until we have a decent batch,
+	// then resample all of it at once
+	batch_len = 0;
+	if( pcm_file != NULL ){
+		read_pcm_batch();
+	}
+	else{
+		int limit = batch_limit();
+		while( batch_len < limit ){
+			if( !frame_pending && !receive_frame() ){
+				break;
 			}
+			if( !append_to_batch() ){
+				// different format or no more space, the frame goes into the next batch
+				break;
+			}
+		}
+	}
+	
+	if( batch_len > 0 ){
+		return resample_batch();
+	}
+	else{
+		// no data read...
+		decoded_buffer_len = 0;
+		decoded_buffer_pos = 0;
+		if( switch_to_next_file() ){
+			return decode_next_frame();
+		}
+		else if( isLooping ){
+			// everything before was played already, so the position starts over right here
+			seek_decoder(0);
+			wrap_length = output_position;
+			output_position = 0;
+			while( decode_next_frame() && skip_to_seek_target() );
 		}
 		else{
-			av_frame_unref(decoded_frame);
+			isPlaying = false;
 		}
 		
-		len = avcodec_decode_audio4(codec_context, decoded_frame, &got_frame, &packet);
-		if (len < 0) {
-			// no data
+		return false;
+	}
+}
+
+// pulls the next frame out of the decoder (into decoded_frame) and feeds it packets as needed.
+// returns false at the end of the file.
+bool OsciAvAudioPlayer::receive_frame(){
+	while( true ){
+		int res = avcodec_receive_frame(codec_context, decoded_frame);
+		if( res == 0 ){
+			frame_pending = true;
+			return true;
+		}
+		else if( res != AVERROR(EAGAIN) || decoder_flushed ){
+			// end of file, or something is seriously broken
 			return false;
 		}
 		
-		if( packet.stream_index != audio_stream_id ){
+		// the decoder is hungry
+		av_packet_unref(&packet);
+		if( av_read_frame(container, &packet) < 0 ){
+			// no more packets, let the decoder drain its buffered frames
+			avcodec_send_packet(codec_context, NULL);
+			decoder_flushed = true;
+		}
+		else if( packet.stream_index == audio_stream_id ){
+			// broken packets are skipped, the decoder recovers with the next one
+			avcodec_send_packet(codec_context, &packet);
+		}
+	}
+}
+
+// input samples per channel that fit into one batch without overflowing the output buffers
+int OsciAvAudioPlayer::input_sample_rate(){
+	int rate = pcm_file != NULL? pcm_file->getSampleRate() : codec_context->sample_rate;
+	return rate > 0? rate : output_sample_rate;
+}
+
+int OsciAvAudioPlayer::batch_limit(){
+	int input_rate = input_sample_rate();
+	int max_rate = max(output_sample_rate, visual_sample_rate);
+	// leave some room for samples the resamplers hold back
+	int64_t output_frames = AVCODEC_MAX_AUDIO_FRAME_SIZE/max(output_num_channels,2) - 256;
+	int limit = (int)(output_frames*input_rate/max_rate);
+	return MAX(1, MIN(limit, AVCODEC_DECODE_BATCH_SIZE));
+}
+
+// moves decoded_frame into the batch.
+// returns false (and keeps the frame) if it can't be added to the current batch.
+bool OsciAvAudioPlayer::append_to_batch(){
+	AVFrame * frame = decoded_frame;
+	int64_t channel_layout = frame->channel_layout;
+	if( channel_layout == 0 ){
+		channel_layout = av_get_default_channel_layout( frame->channels );
+	}
+	
+	bool same_format = frame->format == batch_format && frame->channels == batch_channels &&
+		frame->sample_rate == batch_sample_rate && channel_layout == batch_channel_layout;
+	
+	if( batch_len > 0 && ( !same_format || batch_len + frame->nb_samples > batch_capacity ) ){
+		return false;
+	}
+	
+	if( batch_len == 0 ){
+		batch_pts = frame->pts;
+	}
+	
+	if( batch_data == NULL || !same_format || frame->nb_samples > batch_capacity ){
+		if( !alloc_batch(frame->format, frame->channels, frame->sample_rate, channel_layout, max(2*AVCODEC_DECODE_BATCH_SIZE, frame->nb_samples)) ){
+			frame_pending = false;
 			return false;
 		}
+	}
+	
+	av_samples_copy(batch_data, frame->extended_data, batch_len, 0, frame->nb_samples, batch_channels, (AVSampleFormat)batch_format);
+	batch_len += frame->nb_samples;
+	av_frame_unref(frame);
+	frame_pending = false;
+	
+	return true;
+}
+
+// (re)allocates the batch for a new input format
+bool OsciAvAudioPlayer::alloc_batch( int format, int channels, int sample_rate, int64_t channel_layout, int capacity ){
+	if( batch_data ){
+		av_freep(&batch_data[0]);
+		av_freep(&batch_data);
+	}
+	
+	batch_format = format;
+	batch_channels = channels;
+	batch_sample_rate = sample_rate;
+	batch_channel_layout = channel_layout;
+	batch_capacity = capacity;
+	
+	// the resamplers need to match the new input
+	output_config_changed = true;
+	visual_config_changed = true;
+	
+	if( av_samples_alloc_array_and_samples(&batch_data, NULL, batch_channels, batch_capacity, (AVSampleFormat)batch_format, 0) < 0 ){
+		fprintf(stderr, "Could not allocate decode buffer\n");
+		batch_data = NULL;
+		batch_capacity = 0;
+		return false;
+	}
+	return true;
+}
 
-		if (got_frame) {
+// plain pcm files skip the decoder, the batch is converted to float straight from the mapped file
+void OsciAvAudioPlayer::read_pcm_batch(){
+	int channels = pcm_file->getNumChannels();
+	int rate = pcm_file->getSampleRate();
+	int64_t layout = av_get_default_channel_layout(channels);
+	if( batch_data == NULL || batch_format != AV_SAMPLE_FMT_FLT || batch_channels != channels || batch_sample_rate != rate || batch_channel_layout != layout ){
+		if( !alloc_batch(AV_SAMPLE_FMT_FLT, channels, rate, layout, 2*AVCODEC_DECODE_BATCH_SIZE) ){
+			return;
+		}
+	}
+	
+	// no timestamps, the position simply carries on from the last batch
+	batch_pts = AV_NOPTS_VALUE;
+	batch_len = pcm_file->read(pcm_position, (float*)batch_data[0], min(batch_limit(), batch_capacity));
+	pcm_position += batch_len;
+}
+
+bool OsciAvAudioPlayer::resample_batch(){
+	if( swr_context != NULL && output_config_changed ){
+		output_config_changed = false;
+		if( swr_context ){
+			swr_close(swr_context);
+			swr_free(&swr_context);
+			swr_context = NULL;
+		}
+	}
+	
+	if( swr_context == NULL ){
+		output_config_changed = false;
+		swr_context = swr_alloc_set_opts(NULL,
+										 output_channel_layout, AV_SAMPLE_FMT_FLT, output_sample_rate,
+										 batch_channel_layout, (AVSampleFormat)batch_format, batch_sample_rate,
+										 0, NULL);
+		if( swr_context && num_visual_pairs > 1 && output_num_channels == 2 ){
+			// we want to hear the first pair, not a downmix of all of them
+			vector<double> matrix(2*batch_channels, 0.0);
+			matrix[0] = 1;
+			matrix[batch_channels+1] = 1;
+			swr_set_matrix(swr_context, matrix.data(), batch_channels);
+		}
+		if (!swr_context || swr_init(swr_context) < 0){
+			fprintf(stderr, "Could not allocate resampler context\n");
+			swr_free(&swr_context);
+			return false;
+		}
+		
+		int next_v_rate = output_sample_rate;
+		if( next_v_rate != visual_sample_rate ){
+			visual_sample_rate = max(192000,next_v_rate);
+		}
+		// the render stream is usually made from the main stream, so it has to follow
+		visual_config_changed = true;
+	}
+	
+	if( visual_config_changed ){
+		visual_config_changed = false;
+		if( swr_context192 != NULL ){
+			swr_close(swr_context192);
+			swr_free(&swr_context192);
+			swr_context192 = NULL;
+		}
+		
+		// pick the cheapest way to get the render stream
+		bool stereo = output_num_channels == 2 && num_visual_pairs == 1;
+		bool multi = num_visual_pairs > 1;
+		if( stereo && visual_sample_rate == output_sample_rate ){
+			visual_mode = VISUAL_COPY;
+		}
+		else if( stereo && interpolate && visual_sample_rate%output_sample_rate == 0 ){
+			visual_mode = VISUAL_UPSAMPLE;
+			visual_upsampler.setup(visual_sample_rate/output_sample_rate);
+		}
+		else{
+			// resample the main stream if we can, the input format doesn't matter then
+			// with several pairs all channels are resampled, in the same layout as the source
+			visual_mode = stereo? VISUAL_RESAMPLE : VISUAL_FROM_SOURCE;
+			swr_context192 = swr_alloc_set_opts(NULL,
+												multi? batch_channel_layout : av_get_default_channel_layout(2), AV_SAMPLE_FMT_FLT, visual_sample_rate,
+												stereo? av_get_default_channel_layout(2) : batch_channel_layout,
+												stereo? AV_SAMPLE_FMT_FLT : (AVSampleFormat)batch_format,
+												stereo? output_sample_rate : batch_sample_rate,
+												0, NULL);
 			
-			if( swr_context != NULL && output_config_changed ){
-				output_config_changed = false;
-				if( swr_context ){
-					swr_close(swr_context);
-					swr_free(&swr_context);
-					swr_context = NULL;
-				}
+			//enable these two to disable interpolation
+			if(swr_context192 && !interpolate){
+				av_opt_set_int(swr_context192, "filter_size", 4, 0);
+				av_opt_set_int(swr_context192, "linear_interp", 1, 0);
 			}
-			
-			if( swr_context == NULL ){
-				int input_channel_layout = decoded_frame->channel_layout;
-				if( input_channel_layout == 0 ){
-					input_channel_layout = av_get_default_channel_layout( codec_context->channels );
-				}
-				swr_context = swr_alloc_set_opts(NULL,
-												 output_channel_layout, AV_SAMPLE_FMT_FLT, output_sample_rate,
-												 input_channel_layout, (AVSampleFormat)decoded_frame->format, decoded_frame->sample_rate,
-												 0, NULL);
-				swr_init(swr_context);
-				
-				if (!swr_context){
-					fprintf(stderr, "Could not allocate resampler context\n");
-					return false;
-				}
-				
-				int next_v_rate = output_sample_rate;
-				if( next_v_rate != visual_sample_rate ){
-					visual_sample_rate = max(192000,next_v_rate);
-					visual_config_changed = true;
-				}
+			else if(swr_context192){
+				// it's only for drawing, a short filter is plenty
+				av_opt_set_int(swr_context192, "filter_size", 8, 0);
+				av_opt_set_int(swr_context192, "phase_shift", 8, 0);
 			}
 			
-			if( swr_context192 != NULL && visual_config_changed ){
-				swr_close(swr_context192);
+			//				av_opt_set_int(swr_context192, "dither_scale", 0, 0);
+			if (!swr_context192 || swr_init(swr_context192) < 0){
+				fprintf(stderr, "Could not allocate resampler-192k context\n");
 				swr_free(&swr_context192);
-				swr_context192 = NULL;
+				return false;
 			}
-			
-			if( swr_context192 == NULL ){
-				visual_config_changed = false;
-				int input_channel_layout = decoded_frame->channel_layout;
-				if( input_channel_layout == 0 ){
-					input_channel_layout = av_get_default_channel_layout( codec_context->channels );
-				}
-				swr_context192 = swr_alloc_set_opts(NULL,
-												 av_get_default_channel_layout(2), AV_SAMPLE_FMT_FLT, visual_sample_rate,
-												 input_channel_layout, (AVSampleFormat)decoded_frame->format, decoded_frame->sample_rate,
-												 0, NULL);
-
-				//enable these two to disable interpolation
-				if(!interpolate){
-					av_opt_set_int(swr_context192, "filter_size", 4, 0);
-					av_opt_set_int(swr_context192, "linear_interp", 1, 0);
-				}
-
-				
-				//				av_opt_set_int(swr_context192, "dither_scale", 0, 0);
-				swr_init(swr_context192);
-				if (!swr_context192){
-					fprintf(stderr, "Could not allocate resampler-192k context\n");
-					return false;
+		}
+	}
+	
+	// where the new data starts, in case the batch has no timestamp
+	int64_t next_frame = decoded_buffer_frame + decoded_buffer_len/output_num_channels;
+	// the resampler first hands out what it held back from earlier batches
+	int64_t delay = swr_get_delay(swr_context, output_sample_rate);
+	
+	/* resample the whole batch to the output rate */
+	int samples_per_channel = AVCODEC_MAX_AUDIO_FRAME_SIZE/output_num_channels;
+	uint8_t * out = (uint8_t*)decoded_buffer;
+	int samples_converted = max(0, swr_convert(swr_context,
+										(uint8_t**)&out, samples_per_channel,
+										(const uint8_t**)batch_data, batch_len));
+	decoded_buffer_len = samples_converted*output_num_channels;
+	decoded_buffer_pos = 0;
+	
+	/* and make the render stream */
+	uint8_t * out192 = (uint8_t*)decoded_buffer192;
+	int samples_converted192 = 0;
+	switch( visual_mode ){
+		case VISUAL_COPY:
+			memcpy(decoded_buffer192, decoded_buffer, decoded_buffer_len*sizeof(float));
+			samples_converted192 = samples_converted;
+			break;
+		case VISUAL_UPSAMPLE:
+			samples_converted192 = min(samples_converted, AVCODEC_MAX_AUDIO_FRAME_SIZE/2/visual_upsampler.getFactor());
+			visual_upsampler.process(decoded_buffer, samples_converted192, decoded_buffer192);
+			samples_converted192 *= visual_upsampler.getFactor();
+			break;
+		case VISUAL_RESAMPLE:
+			samples_converted192 = swr_convert(swr_context192,
+											   (uint8_t**)&out192, AVCODEC_MAX_AUDIO_FRAME_SIZE/2,
+											   (const uint8_t**)&out, samples_converted);
+			break;
+		case VISUAL_FROM_SOURCE:
+			if( num_visual_pairs == 1 ){
+				samples_converted192 = swr_convert(swr_context192,
+												   (uint8_t**)&out192, AVCODEC_MAX_AUDIO_FRAME_SIZE/2,
+												   (const uint8_t**)batch_data, batch_len);
+			}
+			else{
+				// all channels in one go, then split them into pairs
+				int channels = batch_channels;
+				decoded_multi192.resize(channels*AVCODEC_MAX_AUDIO_FRAME_SIZE/2);
+				uint8_t * outMulti = (uint8_t*)decoded_multi192.data();
+				samples_converted192 = max(0, swr_convert(swr_context192,
+														  &outMulti, AVCODEC_MAX_AUDIO_FRAME_SIZE/2,
+														  (const uint8_t**)batch_data, batch_len));
+				for( int p = 0; p < num_visual_pairs; p++ ){
+					float * dest = p == 0? decoded_buffer192 : decoded_pairs192[p-1].data();
+					if( 2*p+1 >= channels ){
+						memset(dest, 0, 2*samples_converted192*sizeof(float));
+						continue;
+					}
+					const float * src = decoded_multi192.data() + 2*p;
+					for( int i = 0; i < samples_converted192; i++ ){
+						dest[2*i] = src[i*channels];
+						dest[2*i+1] = src[i*channels+1];
+					}
 				}
 			}
-			
-			/* if a frame has been decoded, resample to desired rate */
-			uint8_t * out192 = (uint8_t*)decoded_buffer192;
-			int samples_converted192 = swr_convert(swr_context192,
-												   (uint8_t**)&out192, AVCODEC_MAX_AUDIO_FRAME_SIZE/2,
-												   (const uint8_t**)decoded_frame->extended_data, decoded_frame->nb_samples);
-			
-			decoded_buffer_len192 = samples_converted192*output_num_channels;
-			decoded_buffer_pos192 = 0;
-			
-			int samples_per_channel = AVCODEC_MAX_AUDIO_FRAME_SIZE/output_num_channels;
-			//samples_per_channel = 512;
-			uint8_t * out = (uint8_t*)decoded_buffer;
-			int samples_converted = swr_convert(swr_context,
-												(uint8_t**)&out, samples_per_channel,
-												(const uint8_t**)decoded_frame->extended_data, decoded_frame->nb_samples);
-			decoded_buffer_len = samples_converted*output_num_channels;
-			decoded_buffer_pos = 0;
-			
-		}
-
-		packet.size -= len;
-		packet.data += len;
-//		packet->dts =
-//		packet->pts = AV_NOPTS_VALUE;
-		
-		return true;
+			break;
+	}
+	
+	decoded_buffer_len192 = max(samples_converted192,0)*2;
+	decoded_buffer_pos192 = 0;
+	batch_len = 0;
+	
+	if( batch_pts != AV_NOPTS_VALUE ){
+		decoded_buffer_frame = av_time_to_frames(batch_pts) - delay;
 	}
 	else{
-		// no data read...
-		packet_data_size = 0;
+		decoded_buffer_frame = next_frame;
+	}
+	
+	return true;
+}
+
+// moves the decoder to a keyframe a bit before the target (in output frames).
+// the samples before the target are dropped by skip_to_seek_target().
+void OsciAvAudioPlayer::seek_decoder( int64_t target ){
+	// start the resamplers over, whatever they hold is from the old position
+	output_config_changed = true;
+	visual_config_changed = true;
+	
+	if( pcm_file != NULL ){
+		// no keyframes and no codec delay, we can go right to the sample
+		pcm_position = av_rescale(target, pcm_file->getSampleRate(), output_sample_rate);
+		seek_skip_to = target;
+		decoded_buffer_frame = target;
+		visual_upsampler.reset();
 		decoded_buffer_len = 0;
 		decoded_buffer_pos = 0;
-		if( isLooping ){
-			avformat_seek_file(container,audio_stream_id,0,0,0,AVSEEK_FLAG_ANY);
-			avcodec_flush_buffers(codec_context);
-			decode_next_frame();
-		}
-		else{
-			isPlaying = false;
-		}
-		
-		return false;
+		return;
+	}
+	
+	int64_t preroll = max((int64_t)0, target - (int64_t)output_sample_rate*SEEK_PREROLL_MS/1000);
+	int64_t ts = frames_to_av_time(preroll);
+	// the closest keyframe at or before ts
+	avformat_seek_file(container,audio_stream_id,INT64_MIN,ts,ts,0);
+	avcodec_flush_buffers(codec_context);
+	av_packet_unref(&packet);
+	frame_pending = false;
+	decoder_flushed = false;
+	seek_skip_to = target;
+	// only used if the decoder doesn't tell us timestamps. the demuxer lands
+	// on ts (or a keyframe before it), so that's our best guess.
+	decoded_buffer_frame = preroll;
+	visual_upsampler.reset();
+	decoded_buffer_len = 0;
+	decoded_buffer_pos = 0;
+}
+
+// drops decoded samples before the seek target.
+// returns true if the whole buffer was before the target, ie. more needs to be decoded.
+bool OsciAvAudioPlayer::skip_to_seek_target(){
+	if( seek_skip_to < 0 ) return false;
+	
+	int available = decoded_buffer_len - decoded_buffer_pos;
+	if( available <= 0 ) return true;
+	
+	int64_t skip = (seek_skip_to - decoded_buffer_frame)*output_num_channels - decoded_buffer_pos;
+	if( skip >= available ){
+		decoded_buffer_pos = decoded_buffer_len;
+		return true;
 	}
+	
+	decoded_buffer_pos += max((int64_t)0, skip);
+	seek_skip_to = -1;
+	return false;
+}
+
+// stream time base -> output frames since the start of the stream
+int64_t OsciAvAudioPlayer::av_time_to_frames( int64_t av_time ){
+	AVStream * stream = container->streams[audio_stream_id];
+	int64_t start = stream->start_time == AV_NOPTS_VALUE? 0 : stream->start_time;
+	return av_rescale_q(av_time - start, stream->time_base, av_make_q(1,output_sample_rate));
+}
+
+int64_t OsciAvAudioPlayer::frames_to_av_time( int64_t frames ){
+	AVStream * stream = container->streams[audio_stream_id];
+	int64_t start = stream->start_time == AV_NOPTS_VALUE? 0 : stream->start_time;
+	return av_rescale_q(frames, av_make_q(1,output_sample_rate), stream->time_base) + start;
 }
 
 unsigned long long OsciAvAudioPlayer::av_time_to_millis( int64_t av_time ){
@@ -478,23 +1296,33 @@ unsigned long long OsciAvAudioPlayer::av_time_to_millis( int64_t av_time ){
 	//return av_time*1000*av_q2d(container->streams[audio_stream_id]->time_base);
 }
 
-int64_t OsciAvAudioPlayer::millis_to_av_time( unsigned long long ms ){
-	//TODO: fix conversion
-/*	int64_t timeBase = (int64_t(codec_context->time_base.num) * AV_TIME_BASE) / int64_t(codec_context->time_base.den);
-	int64_t seekTarget = int64_t(ms) / timeBase;*/
-	return av_rescale(ms,container->streams[audio_stream_id]->time_base.den,(uint64_t)container->streams[audio_stream_id]->time_base.num)/1000;
-}
-
 
 
 void OsciAvAudioPlayer::setPositionMS(int ms){
-	next_seekTarget = millis_to_av_time(ms);
+	next_seekTarget = max(0,ms)*(int64_t)output_sample_rate/1000;
+	if( thread != NULL ) thread->wake();
 }
 
 int OsciAvAudioPlayer::getPositionMS(){
+	return getPositionSamples()*1000/output_sample_rate;
+}
+
+int64_t OsciAvAudioPlayer::getPositionSamples(){
 	if( !isLoaded ) return 0;
-	int64_t ts = packet.pts;
-	return av_time_to_millis( ts );
+	// a seek that didn't happen yet
+	int64_t seekTarget = next_seekTarget;
+	if( seekTarget >= 0 ) return seekTarget;
+	// what was decoded, minus what's still waiting for the audio callback
+	int64_t pos = output_position - mainOut.totalLength/2;
+	if( pos < 0 ){
+		// we just looped or moved on to the next file, the end of the previous one is still queued
+		pos += wrap_length;
+	}
+	return max((int64_t)0,pos);
+}
+
+int OsciAvAudioPlayer::getSampleRate(){
+	return output_sample_rate;
 }
 
 float OsciAvAudioPlayer::getPosition(){
@@ -512,6 +1340,7 @@ void OsciAvAudioPlayer::stop(){
 void OsciAvAudioPlayer::play(){
 	if( isLoaded ){
 		isPlaying = true;
+		thread->wake();
 	}
 }
 
@@ -536,6 +1365,7 @@ string OsciAvAudioPlayer::getMetadata( string key ){
 
 map<string,string> OsciAvAudioPlayer::getMetadata(){
 	map<string,string> meta;
+	if( container == NULL ) return meta;
 	AVDictionary * d = container->metadata;
 	AVDictionaryEntry *t = NULL;
 	while ((t = av_dict_get(d, "", t, AV_DICT_IGNORE_SUFFIX))!=0){
@@ -550,12 +1380,14 @@ void OsciAvAudioPlayer::beginSync( int bufferSize ){
 	
 	wantsAsync = false;
 	while( thread->isAsync ){
+		thread->wake();
 		ofSleepMillis(10);
 	}
 	
-	left192.clear();
-	right192.clear();
-	mainOut.clear();
+	clearQueues();
+	// nobody reads the main output in sync mode, so we drop it ourselves.
+	// otherwise the queued audio would still count in getPositionSamples()
+	mainOut.peel(0);
 	
 	output_expected_buffer_size = bufferSize;
 }
@@ -565,6 +1397,50 @@ void OsciAvAudioPlayer::endSync(){
 	wantsAsync = true;
 	
 	while( !thread->isAsync ){
+		thread->wake();
 		ofSleepMillis(10);
 	}
-}
\ No newline at end of file
+}
+void OsciAvAudioPlayer::queueSound(string fileName){
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		queue.push_back(ofToDataPath(fileName,true));
+	}
+	if( thread != NULL ) thread->wake();
+}
+
+void OsciAvAudioPlayer::clearQueue(){
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		queue.clear();
+	}
+	if( thread != NULL ) thread->lock();
+	close_file(next_file);
+	if( thread != NULL ) thread->unlock();
+}
+
+int OsciAvAudioPlayer::getQueueSize(){
+	lock_guard<mutex> lock(queue_mutex);
+	return (int)queue.size() + (next_file.isOpen()? 1 : 0);
+}
+
+string OsciAvAudioPlayer::getFileName(){
+	lock_guard<mutex> lock(queue_mutex);
+	return isLoaded? file_name : "";
+}
+
+string OsciAvAudioPlayer::take_load_request(){
+	lock_guard<mutex> lock(queue_mutex);
+	string res = load_request;
+	load_request = "";
+	return res;
+}
+
+int OsciAvAudioPlayer::getNumVisualPairs(){
+	return num_visual_pairs;
+}
+
+StereoSample & OsciAvAudioPlayer::getVisualPair( int pair ){
+	if( pair < 0 || pair >= VISUAL_MAX_PAIRS || visual_pairs[pair] == NULL ) return stereo192;
+	return *visual_pairs[pair];
+}
@@ -20,6 +20,9 @@
 
 #include <math.h>
 #include <map>
+#include <deque>
+#include <mutex>
+#include <atomic>
 #include "ofMain.h"
 
 extern "C"{
@@ -37,10 +40,15 @@ extern "C"{
 //with flac files written by audacity it's actually quite easy to cause serious read troubles
 //when using frame=192k, inbuf=20480, thres=4096
 #define AVCODEC_MAX_AUDIO_FRAME_SIZE (192000)
-#define AVCODEC_AUDIO_INBUF_SIZE (20480)
-#define AVCODEC_AUDIO_REFILL_THRESH (4096*3)
+// decoded frames are collected until there are this many input samples per channel,
+// then they are resampled in one go
+#define AVCODEC_DECODE_BATCH_SIZE (4096)
+// files with four or more channels are drawn as several XY pairs, up to this many
+#define VISUAL_MAX_PAIRS (4)
 
 class OsciAvAudioPlayerThread;
+class PcmCache;
+class PcmFile;
 
 class OsciAvAudioPlayer{
 public: 
@@ -70,9 +78,47 @@ public:
 	// hansi: currently stream is always yes
 	bool loadSound(std::string fileName, bool stream = true);
 	
+	/// \brief Loads a file in the background. Safe to call from any thread.
+	///
+	/// The file is opened on the decoder thread and swapped in once it's ready,
+	/// the current file keeps playing until then. If more requests come in
+	/// before the decoder gets to them, only the latest one is loaded.
+	/// loadEvent is notified when done.
+	///
+	/// \param fileName Path to the sound file, relative to your app's data folder.
+	void loadSoundAsync(std::string fileName);
+	
+	struct LoadEventArgs{
+		std::string fileName;
+		bool success;
+	};
+	
+	/// \brief Notified after loadSoundAsync(). Careful, this is called from the decoder thread.
+	ofEvent<LoadEventArgs> loadEvent;
+	
 	/// \brief Stops and unloads the current sound.
 	void unloadSound();
 	
+	/// \brief Adds a file to the end of the playlist.
+	///
+	/// While a file plays, the decoder thread already opens the next one in the
+	/// playlist. It follows the current file without a gap, right at the next sample.
+	/// With looping enabled, finished files go back to the end of the playlist.
+	/// Files that can't be opened are skipped.
+	///
+	/// \param fileName Path to the sound file, relative to your app's data folder.
+	void queueSound(std::string fileName);
+	
+	/// \brief Removes all files from the playlist (the current file keeps playing).
+	void clearQueue();
+	
+	/// \brief Gets the number of files waiting in the playlist.
+	int getQueueSize();
+	
+	/// \brief Gets the file that is currently playing.
+	/// \return absolute path of the file, or an empty string.
+	std::string getFileName();
+	
 	/// \brief Starts playback.
 	void play();
 	
@@ -111,10 +157,72 @@ public:
 	/// \param ms number of milliseconds from the start of the file.
 	void setPositionMS(int ms);
 	
+	/// \brief Sets how far the decoder thread reads ahead of playback.
+	///
+	/// The decoder wakes up once less than half of the main read-ahead is queued,
+	/// then decodes until either stream is full.
+	///
+	/// \param mainMS milliseconds of output audio to keep queued (0: four audio buffers)
+	/// \param visualMS milliseconds of render stream to keep queued (0: four audio buffers)
+	void setReadAheadMS( int mainMS, int visualMS );
+	
+	/// \brief Gets how much output audio is currently decoded and waiting.
+	/// \return queued audio in milliseconds.
+	int getQueuedMS();
+	
+	/// \brief Gets how much of the render stream is decoded and waiting for playback.
+	/// \return queued render stream in milliseconds.
+	int getVisualQueuedMS();
+	
+	/// \brief Enables the whole-file decode cache.
+	///
+	/// Files that fit are decoded completely in the background after loading.
+	/// Once that is done, seeking and looping no longer touch the decoder.
+	///
+	/// \param maxBytes memory limit per file, 0 disables the cache.
+	void setDecodeCacheSize( size_t maxBytes );
+	
+	/// \brief Keeps decoded files on disk, so they only need to be decoded once.
+	///
+	/// Reopening a file with the same path, size and modification date maps
+	/// the decoded data from disk instead of decoding it again.
+	/// This is used instead of the memory cache when enabled.
+	///
+	/// \param directory where to keep the decoded files
+	/// \param maxBytes size limit for the whole directory, 0 disables the disk cache.
+	void setDiskCache( std::string directory, size_t maxBytes );
+	
+	/// \brief Queries whether playback currently comes from the decode cache.
+	bool isCached();
+	
+	/// \brief Gets the sample rate of the render stream.
+	int getVisualSampleRate();
+	
+	/// \brief Gets the number of XY pairs in the render stream.
+	///
+	/// Files with four or more channels are split into channel pairs (1+2, 3+4, ...),
+	/// everything else is a single pair. All pairs come out of the same decode pass.
+	/// In that case the main output plays the first pair.
+	int getNumVisualPairs();
+	
+	/// \brief Gets the render stream of one XY pair. Pair 0 is stereo192.
+	/// \param pair 0 ... VISUAL_MAX_PAIRS-1
+	StereoSample & getVisualPair( int pair );
+	
+	// counts audio callbacks that couldn't be filled completely while playing
+	std::atomic<int> underrunCount;
+	
 	/// \brief Gets position of the playhead.
 	/// \return playhead position in milliseconds.
 	int getPositionMS();
 	
+	/// \brief Gets position of the playhead, exact to the sample.
+	/// \return playhead position in frames at the output sample rate.
+	int64_t getPositionSamples();
+	
+	/// \brief Gets the output sample rate (see setupAudioOut()).
+	int getSampleRate();
+	
 	/// \brief Gets position of the playhead (0..1).
 	/// \return playhead position as a float between 0 and 1.
 	float getPosition();
@@ -163,27 +271,89 @@ public:
 	bool isMonoFile; 
 
 	MonoSample mainOut; // interleaved main output
-	MonoSample left192;
-	MonoSample right192;
+	StereoSample stereo192; // render stream (first pair)
 	
 private:
+	// render stream decoded ahead, released to stereo192 as the main stream plays
+	StereoSample pending192;
+	
 	int internalAudioOut(float *output, int bufferSize, int nChannels);
+	int cachedAudioOut(float *output, int bufferSize, int nChannels);
+	int read_cache( float * output, int N );
+	void startCache();
+	void stopCache();
+	
+	void releaseVisual( int frames );
+	void set_visual_pairs( int pairs );
+	void clearQueues();
+	int lowWaterFrames();
+	int highWaterFrames();
+	int visualHighWaterFrames();
 	
 	unsigned long long av_time_to_millis( int64_t av_time );
-	int64_t millis_to_av_time( unsigned long long ms );
+	int64_t av_time_to_frames( int64_t av_time );
+	int64_t frames_to_av_time( int64_t frames );
+	
+	bool receive_frame();
+	bool append_to_batch();
+	bool alloc_batch( int format, int channels, int sample_rate, int64_t channel_layout, int capacity );
+	void read_pcm_batch();
+	int input_sample_rate();
+	int batch_limit();
+	bool resample_batch();
+	void seek_decoder( int64_t target );
+	bool skip_to_seek_target();
+	
+	// the parts of a file that can be opened ahead of time.
+	// plain pcm files only have pcm, everything else has container and codec_context.
+	struct OpenFile{
+		std::string fileName;
+		AVFormatContext * container{NULL};
+		AVCodecContext * codec_context{NULL};
+		int audio_stream_id{-1};
+		PcmFile * pcm{NULL};
+		
+		bool isOpen() const{ return container != NULL || pcm != NULL; }
+	};
+	bool open_file( std::string fileName, OpenFile & file );
+	void close_file( OpenFile & file );
+	void use_file( OpenFile & file );
+	void prepare_next_file();
+	bool switch_to_next_file();
+	bool install_file( OpenFile & file );
+	void close_current();
+	void start_thread();
+	std::string take_load_request();
 	
 	// i think these could be useful public, rarely, but still ...
 	AVPacket packet;
-	int packet_data_size;
 	int buffer_size; 
-	uint8_t inbuf[AVCODEC_AUDIO_INBUF_SIZE + FF_INPUT_BUFFER_PADDING_SIZE];
-	int len;
 	int audio_stream_id;
 	
 	// contains audio data, usually decoded as non-interleaved float array
 	AVFrame *decoded_frame;
+	// decoded_frame holds a frame that didn't make it into the last batch
+	bool frame_pending;
+	// the end of the file was sent to the decoder
+	bool decoder_flushed;
+	// position of decoded_buffer in the file, in output frames
+	int64_t decoded_buffer_frame;
+	
+	// decoded frames in the file's native format, waiting to be resampled
+	uint8_t ** batch_data;
+	int batch_len;
+	int64_t batch_pts;
+	int batch_capacity;
+	int batch_format;
+	int batch_channels;
+	int batch_sample_rate;
+	int64_t batch_channel_layout;
 	AVCodecContext* codec_context;
 	AVFormatContext* container;
+	// set instead of the two above for plain wav/aiff files
+	PcmFile * pcm_file;
+	// next frame to read from pcm_file
+	int64_t pcm_position;
 
 	SwrContext * swr_context;
 	SwrContext * swr_context192;
@@ -194,8 +364,19 @@ private:
 	int64_t output_channel_layout;
 	int output_num_channels;
 	int output_expected_buffer_size;
+	int read_ahead_ms;
+	int visual_read_ahead_ms;
+	int64_t visual_release_remainder;
 	
+	// seek target in output frames, -1 if there is none
 	int64_t next_seekTarget;
+	// after seeking, decoded samples before this frame are dropped (-1 when done)
+	int64_t seek_skip_to;
+	// position of the next sample that will be written to the output, in output frames.
+	// counted from the samples that actually went out, so it's exact.
+	std::atomic<int64_t> output_position;
+	// length of what played before output_position last started over (loop or next file), in output frames
+	int64_t wrap_length;
 	
 	// contains audio data, always in interleaved float format
 	int decoded_buffer_pos;
@@ -207,10 +388,53 @@ private:
 	
 	bool output_config_changed;
 	bool visual_config_changed;
+	
+	// how the render stream is made
+	enum VisualMode{
+		VISUAL_COPY, // same rate as the output, copy it
+		VISUAL_UPSAMPLE, // integer multiple of the output rate, upsample it
+		VISUAL_RESAMPLE, // resample the output with a cheap filter
+		VISUAL_FROM_SOURCE // resample the source (only if the output isn't stereo)
+	};
+	VisualMode visual_mode;
+	StereoUpsampler visual_upsampler;
+	
+	// render streams per XY pair, [0] is stereo192/pending192.
+	// the others are allocated for the first file that needs them and stay around.
+	std::atomic<int> num_visual_pairs;
+	StereoSample * visual_pairs[VISUAL_MAX_PAIRS];
+	StereoSample * pending_pairs[VISUAL_MAX_PAIRS];
+	// pairs after the first one, interleaved stereo like decoded_buffer192
+	std::vector<std::vector<float>> decoded_pairs192;
+	// all channels at the render rate, before they're split into pairs
+	std::vector<float> decoded_multi192;
 	bool wantsAsync;
 	
 	bool interpolate{true};
 	
+	// whole-file decode cache
+	std::string file_name;
+	PcmCache * cache;
+	bool cache_active;
+	// the cache is kept at the file's own rate, this brings it to the output rate (NULL if they match)
+	SwrContext * cache_swr_context;
+	// next frame to read from the cache, at the cache's rate
+	int64_t cache_position;
+	// cache_position has to be worked out from output_position again (seek, rate change, ...)
+	bool cache_resync;
+	// interleaved stereo, read from the cache and resampled
+	std::vector<float> cache_input;
+	std::vector<float> cache_buffer;
+	int cache_buffer_pos;
+	int cache_buffer_len;
+	
+	// playlist. queue_mutex guards the list, file_name and load_request, next_file is only touched with the thread locked.
+	std::deque<std::string> queue;
+	std::mutex queue_mutex;
+	OpenFile next_file;
+	// file waiting for loadSoundAsync()
+	std::string load_request;
+	
 	friend class OsciAvAudioPlayerThread;
 	OsciAvAudioPlayerThread * thread;
 };
@@ -220,8 +444,15 @@ class OsciAvAudioPlayerThread : public ofThread{
 public:
 	OsciAvAudioPlayerThread( OsciAvAudioPlayer &player );
 	void threadedFunction();
+	// ask the decoder to refill the output queue. never blocks, safe to call from the audio callback.
+	void wake();
 	
 	OsciAvAudioPlayer &player;
 	bool isAsync; 
+	
+private:
+	WakeSignal wakeSignal;
+	// decoded blocks go here before they're queued, allocated once
+	std::vector<float> refillBuffer;
 };
 #endif
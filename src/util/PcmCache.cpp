@@ -0,0 +1,413 @@
+//
+//  PcmCache.cpp
+//  Oscilloscope
+//
+
+#include "PcmCache.h"
+#include "OsciAvAudioPlayer.h"
+#include <Poco/File.h>
+#include <Poco/Path.h>
+#include <Poco/Timestamp.h>
+#include <Poco/Exception.h>
+#include <algorithm>
+using namespace std;
+
+// frames per sync read while building the cache
+#define PCM_CACHE_BLOCK_SIZE 4096
+// bump this when the decoding changes, old cache files are ignored then
+#define PCM_CACHE_VERSION 1
+
+// every file in the disk cache starts with this.
+// 64 bytes, so the samples after it stay aligned.
+struct PcmCacheHeader{
+	char magic[8];
+	uint64_t key;
+	int64_t numFrames;
+	int32_t sampleRate;
+	int32_t bytesPerSample;
+	char reserved[32];
+};
+
+static const char pcmCacheMagic[8] = {'O','S','C','I','P','C','M','1'};
+
+// fnv-1a, good enough to tell cache entries apart
+static uint64_t hashKey( const string & key ){
+	uint64_t hash = 14695981039346656037ULL;
+	for( size_t i = 0; i < key.size(); i++ ){
+		hash ^= (unsigned char)key[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+PcmCache::PcmCache() :
+	sampleRate(0), visualSampleRate(0),
+	memoryLimit(0), diskLimit(0), diskKey(0), complete(false), fromDisk(false),
+	mainPtr(NULL), visualPtr(NULL), numFrames(0), numVisualFrames(0){
+}
+
+PcmCache::~PcmCache(){
+	cancel();
+}
+
+void PcmCache::setMemoryLimit( size_t maxBytes ){
+	memoryLimit = maxBytes;
+}
+
+void PcmCache::setDiskCache( string directory, size_t maxBytes ){
+	diskDirectory = maxBytes > 0? directory : "";
+	diskLimit = maxBytes;
+}
+
+bool PcmCache::isEnabled(){
+	return memoryLimit > 0 || diskDirectory != "";
+}
+
+void PcmCache::start( string fileName, int sampleRate ){
+	cancel();
+	this->fileName = fileName;
+	this->sampleRate = sampleRate;
+	// the same rule the player uses for the render stream
+	this->visualSampleRate = max(192000, sampleRate);
+	startThread();
+}
+
+void PcmCache::cancel(){
+	if( isThreadRunning() ){
+		waitForThread(true);
+	}
+	release();
+}
+
+void PcmCache::release(){
+	complete = false;
+	fromDisk = false;
+	mainPtr = NULL;
+	visualPtr = NULL;
+	numFrames = 0;
+	numVisualFrames = 0;
+	vector<float>().swap(mainData);
+	vector<int16_t>().swap(visualData);
+	mainMap = Poco::SharedMemory();
+	visualMap = Poco::SharedMemory();
+}
+
+bool PcmCache::isComplete(){
+	return complete;
+}
+
+bool PcmCache::isFromDisk(){
+	return fromDisk;
+}
+
+int PcmCache::getSampleRate(){
+	return sampleRate;
+}
+
+int PcmCache::getVisualSampleRate(){
+	return visualSampleRate;
+}
+
+int64_t PcmCache::getNumFrames(){
+	return numFrames;
+}
+
+int64_t PcmCache::getNumVisualFrames(){
+	return numVisualFrames;
+}
+
+int PcmCache::readMain( int64_t pos, float * output, int N ){
+	if( pos < 0 || pos >= numFrames ) return 0;
+	N = (int)MIN((int64_t)N, numFrames-pos);
+	memcpy(output, mainPtr + 2*pos, 2*N*sizeof(float));
+	return N;
+}
+
+int PcmCache::readVisual( int64_t pos, float * output, int N ){
+	if( pos < 0 || pos >= numVisualFrames ) return 0;
+	N = (int)MIN((int64_t)N, numVisualFrames-pos);
+	const int16_t * data = visualPtr + 2*pos;
+	for( int i = 0; i < 2*N; i++ ){
+		output[i] = data[i]*(1.0f/32767);
+	}
+	return N;
+}
+
+void PcmCache::threadedFunction(){
+	release();
+
+	bool useDisk = diskDirectory != "";
+	if( useDisk ){
+		try{
+			diskKey = hashKey(getKey());
+		}
+		catch( Poco::Exception & e ){
+			// not a regular file
+			useDisk = false;
+		}
+	}
+
+	if( useDisk ){
+		if( mapFromDisk() ){
+			ofLogNotice("PcmCache") << "using disk cache for " << fileName;
+			fromDisk = true;
+			complete = true;
+			return;
+		}
+		if( decode(diskLimit, true) && mapFromDisk() ){
+			evictFromDisk();
+			fromDisk = true;
+			complete = true;
+			return;
+		}
+	}
+
+	if( memoryLimit > 0 && isThreadRunning() && decode(memoryLimit, false) ){
+		mainPtr = mainData.data();
+		visualPtr = visualData.data();
+		numFrames = mainData.size()/2;
+		numVisualFrames = visualData.size()/2;
+		complete = true;
+	}
+}
+
+// decodes the whole file, either into memory or into the disk cache
+bool PcmCache::decode( size_t maxBytes, bool toDisk ){
+	// the decoder is big (it has a few large buffers), keep it off the stack
+	unique_ptr<OsciAvAudioPlayer> decoder(new OsciAvAudioPlayer());
+	decoder->setupAudioOut(2, sampleRate, true);
+	decoder->setupVisualSampleRate(visualSampleRate);
+	if( !decoder->loadSound(fileName) ){
+		return false;
+	}
+
+	int64_t expectedFrames = decoder->duration*(int64_t)sampleRate/1000;
+	int64_t expectedVisualFrames = decoder->duration*(int64_t)visualSampleRate/1000;
+	size_t expectedBytes = expectedFrames*2*sizeof(float) + expectedVisualFrames*2*sizeof(int16_t);
+	if( expectedBytes > maxBytes ){
+		ofLogNotice("PcmCache") << "not caching " << fileName << ", it needs " << (expectedBytes>>20) << "MB";
+		decoder->unloadSound();
+		return false;
+	}
+
+	string mainTmp = getDiskPath(".pcm.tmp");
+	string visualTmp = getDiskPath(".vis.tmp");
+	ofstream mainFile, visualFile;
+	PcmCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	if( toDisk ){
+		try{
+			Poco::File(diskDirectory).createDirectories();
+		}
+		catch( Poco::Exception & e ){
+			ofLogError("PcmCache") << "can't create " << diskDirectory << ": " << e.displayText();
+			decoder->unloadSound();
+			return false;
+		}
+		mainFile.open(mainTmp.c_str(), ios::binary|ios::trunc);
+		visualFile.open(visualTmp.c_str(), ios::binary|ios::trunc);
+		// the real headers are written at the end, once we know the length
+		mainFile.write((const char*)&header, sizeof(header));
+		visualFile.write((const char*)&header, sizeof(header));
+	}
+	else{
+		// a bit of headroom, the duration is not always exact
+		mainData.reserve(2*(expectedFrames + expectedFrames/32 + PCM_CACHE_BLOCK_SIZE));
+		visualData.reserve(2*(expectedVisualFrames + expectedVisualFrames/32 + PCM_CACHE_BLOCK_SIZE));
+	}
+
+	decoder->setLoop(false);
+	decoder->beginSync(PCM_CACHE_BLOCK_SIZE);
+	decoder->setPositionMS(0);
+	decoder->play();
+
+	vector<float> buffer(2*PCM_CACHE_BLOCK_SIZE);
+	vector<int16_t> visualBuffer;
+	int64_t totalFrames = 0;
+	int64_t totalVisualFrames = 0;
+	bool ok = true;
+	while( isThreadRunning() ){
+		int N = decoder->audioOutSync(buffer.data(), PCM_CACHE_BLOCK_SIZE, 2);
+
+		// in sync mode the render stream goes straight to stereo192
+		MonoSample::Span left, right;
+		decoder->stereo192.peekSpan(decoder->stereo192.totalLength, left, right);
+		visualBuffer.resize(2*left.size());
+		int16_t * out = visualBuffer.data();
+		for( int part = 0; part < 2; part++ ){
+			for( int i = 0; i < left.length[part]; i++ ){
+				*out++ = (int16_t)lrintf(ofClamp(left.data[part][i],-1,1)*32767);
+				*out++ = (int16_t)lrintf(ofClamp(right.data[part][i],-1,1)*32767);
+			}
+		}
+		decoder->stereo192.consume(left.size());
+
+		if( toDisk ){
+			mainFile.write((const char*)buffer.data(), 2*N*sizeof(float));
+			visualFile.write((const char*)visualBuffer.data(), visualBuffer.size()*sizeof(int16_t));
+			if( !mainFile || !visualFile ){
+				ofLogError("PcmCache") << "writing to the disk cache failed";
+				ok = false;
+				break;
+			}
+		}
+		else{
+			mainData.insert(mainData.end(), buffer.begin(), buffer.begin()+2*N);
+			visualData.insert(visualData.end(), visualBuffer.begin(), visualBuffer.end());
+		}
+		totalFrames += N;
+		totalVisualFrames += visualBuffer.size()/2;
+
+		if( totalFrames*2*sizeof(float) + totalVisualFrames*2*sizeof(int16_t) > maxBytes ){
+			ofLogNotice("PcmCache") << "not caching " << fileName << ", it's larger than expected";
+			ok = false;
+			break;
+		}
+
+		if( N < PCM_CACHE_BLOCK_SIZE && !decoder->isPlaying ){
+			break;
+		}
+	}
+
+	decoder->endSync();
+	decoder->unloadSound();
+
+	ok = ok && isThreadRunning() && totalFrames > 0 && totalVisualFrames > 0;
+	if( toDisk ){
+		if( ok ){
+			memcpy(header.magic, pcmCacheMagic, sizeof(header.magic));
+			header.key = diskKey;
+			header.numFrames = totalFrames;
+			header.sampleRate = sampleRate;
+			header.bytesPerSample = sizeof(float);
+			mainFile.seekp(0);
+			mainFile.write((const char*)&header, sizeof(header));
+
+			header.numFrames = totalVisualFrames;
+			header.sampleRate = visualSampleRate;
+			header.bytesPerSample = sizeof(int16_t);
+			visualFile.seekp(0);
+			visualFile.write((const char*)&header, sizeof(header));
+			ok = mainFile.good() && visualFile.good();
+		}
+		mainFile.close();
+		visualFile.close();
+
+		try{
+			if( ok ){
+				Poco::File(visualTmp).renameTo(getDiskPath(".vis"));
+				Poco::File(mainTmp).renameTo(getDiskPath(".pcm"));
+			}
+			else{
+				Poco::File(mainTmp).remove();
+				Poco::File(visualTmp).remove();
+			}
+		}
+		catch( Poco::Exception & e ){
+			ofLogError("PcmCache") << "can't update the disk cache: " << e.displayText();
+			ok = false;
+		}
+	}
+	else{
+		if( ok ){
+			mainData.shrink_to_fit();
+			visualData.shrink_to_fit();
+		}
+		else{
+			vector<float>().swap(mainData);
+			vector<int16_t>().swap(visualData);
+		}
+	}
+
+	return ok;
+}
+
+// everything that changes the decoded data
+string PcmCache::getKey(){
+	Poco::File file(fileName);
+	return fileName + "|" + ofToString(file.getSize()) + "|" + ofToString(file.getLastModified().epochMicroseconds()) +
+		"|" + ofToString(sampleRate) + "|" + ofToString(visualSampleRate) + "|" + ofToString(PCM_CACHE_VERSION);
+}
+
+string PcmCache::getDiskName(){
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx", (unsigned long long)diskKey);
+	return name;
+}
+
+string PcmCache::getDiskPath( string extension ){
+	return diskDirectory + "/" + getDiskName() + extension;
+}
+
+bool PcmCache::mapFromDisk(){
+	try{
+		Poco::File mainFile(getDiskPath(".pcm"));
+		Poco::File visualFile(getDiskPath(".vis"));
+		if( !mainFile.exists() || !visualFile.exists() ){
+			return false;
+		}
+
+		mainMap = Poco::SharedMemory(mainFile, Poco::SharedMemory::AM_READ);
+		visualMap = Poco::SharedMemory(visualFile, Poco::SharedMemory::AM_READ);
+
+		Poco::SharedMemory * maps[2] = {&mainMap, &visualMap};
+		int rates[2] = {sampleRate, visualSampleRate};
+		int sizes[2] = {sizeof(float), sizeof(int16_t)};
+		int64_t frames[2];
+		for( int i = 0; i < 2; i++ ){
+			size_t size = maps[i]->end() - maps[i]->begin();
+			if( size < sizeof(PcmCacheHeader) ) throw Poco::DataFormatException("file too short");
+			const PcmCacheHeader * header = (const PcmCacheHeader*)maps[i]->begin();
+			if( memcmp(header->magic, pcmCacheMagic, sizeof(header->magic)) != 0 || header->key != diskKey ||
+			   header->sampleRate != rates[i] || header->bytesPerSample != sizes[i] ||
+			   header->numFrames <= 0 || size < sizeof(PcmCacheHeader) + header->numFrames*2*sizes[i] ){
+				throw Poco::DataFormatException("bad header");
+			}
+			frames[i] = header->numFrames;
+		}
+
+		mainPtr = (const float*)(mainMap.begin() + sizeof(PcmCacheHeader));
+		visualPtr = (const int16_t*)(visualMap.begin() + sizeof(PcmCacheHeader));
+		numFrames = frames[0];
+		numVisualFrames = frames[1];
+
+		// the modification date keeps track of the last use
+		mainFile.setLastModified(Poco::Timestamp());
+		visualFile.setLastModified(Poco::Timestamp());
+		return true;
+	}
+	catch( Poco::Exception & e ){
+		ofLogNotice("PcmCache") << "can't use disk cache for " << fileName << ": " << e.displayText();
+		release();
+		return false;
+	}
+}
+
+// remove the least recently used files until the cache fits into its budget
+void PcmCache::evictFromDisk(){
+	try{
+		vector<Poco::File> files;
+		Poco::File(diskDirectory).list(files);
+
+		size_t total = 0;
+		for( size_t i = 0; i < files.size(); i++ ){
+			total += files[i].getSize();
+		}
+		if( total <= diskLimit ) return;
+
+		sort(files.begin(), files.end(), []( const Poco::File & a, const Poco::File & b ){
+			return a.getLastModified() < b.getLastModified();
+		});
+
+		string keep = getDiskName();
+		for( size_t i = 0; i < files.size() && total > diskLimit; i++ ){
+			if( Poco::Path(files[i].path()).getFileName().compare(0, keep.size(), keep) == 0 ) continue;
+			size_t size = files[i].getSize();
+			files[i].remove();
+			total -= size;
+		}
+	}
+	catch( Poco::Exception & e ){
+		ofLogError("PcmCache") << "can't clean up the disk cache: " << e.displayText();
+	}
+}
@@ -0,0 +1,102 @@
+//
+//  PcmCache.h
+//  Oscilloscope
+//
+//  Keeps a whole file decoded, both at the file's own rate and at the render rate,
+//  so seeking and looping are just a matter of moving a position. The player
+//  resamples the main stream to the output rate, so changing the output rate
+//  (time stretching) doesn't need a new cache.
+//
+//  The file is decoded on a background thread by a second player in sync mode
+//  (the same way the exporter reads files). The main player keeps streaming
+//  until the cache is complete and then switches over.
+//
+//  With a disk cache directory the decoded data is written to disk instead of
+//  memory, and memory mapped from there. Reopening the same file (same path,
+//  size, modification date and rates) then only maps the existing
+//  files. The least recently used entries are removed to stay within a budget.
+//
+
+#ifndef Oscilloscope_PcmCache_h
+#define Oscilloscope_PcmCache_h
+
+#include "ofMain.h"
+#include <atomic>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <stdint.h>
+#include <Poco/SharedMemory.h>
+
+class PcmCache : public ofThread{
+public:
+	PcmCache();
+	~PcmCache();
+
+	// files that would need more than maxBytes in memory are not cached (0 disables memory caching)
+	void setMemoryLimit( size_t maxBytes );
+	// keep decoded files in this directory, limited to maxBytes in total (empty directory disables it)
+	void setDiskCache( std::string directory, size_t maxBytes );
+	bool isEnabled();
+
+	// starts decoding a file in the background (stereo at the given sample rate, usually the file's own)
+	void start( std::string fileName, int sampleRate );
+	// stops decoding and frees the memory
+	void cancel();
+
+	// true once the whole file is decoded
+	bool isComplete();
+	// true if the data came from the disk cache
+	bool isFromDisk();
+	int getSampleRate();
+	int getVisualSampleRate();
+
+	// number of frames at sampleRate and at the render rate
+	int64_t getNumFrames();
+	int64_t getNumVisualFrames();
+
+	// copy up to N interleaved stereo frames, starting at frame pos.
+	// returns the number of frames copied. only valid once the cache is complete.
+	int readMain( int64_t pos, float * output, int N );
+	int readVisual( int64_t pos, float * output, int N );
+
+	void threadedFunction();
+
+private:
+	bool decode( size_t maxBytes, bool toDisk );
+	std::string getKey();
+	std::string getDiskName();
+	std::string getDiskPath( std::string extension );
+	bool mapFromDisk();
+	void evictFromDisk();
+	void release();
+
+	std::string fileName;
+	int sampleRate;
+	int visualSampleRate;
+	size_t memoryLimit;
+	std::string diskDirectory;
+	size_t diskLimit;
+	// hash of getKey(), names the files in the disk cache
+	uint64_t diskKey;
+
+	std::atomic<bool> complete;
+	bool fromDisk;
+
+	// interleaved stereo at sampleRate
+	std::vector<float> mainData;
+	// interleaved stereo at the render rate. 16 bit is plenty for drawing and halves the size.
+	std::vector<int16_t> visualData;
+
+	// the same data, mapped from the disk cache
+	Poco::SharedMemory mainMap;
+	Poco::SharedMemory visualMap;
+
+	// whatever is in use
+	const float * mainPtr;
+	const int16_t * visualPtr;
+	int64_t numFrames;
+	int64_t numVisualFrames;
+};
+
+#endif
@@ -0,0 +1,241 @@
+//
+//  PcmFile.cpp
+//  Oscilloscope
+//
+
+#include "PcmFile.h"
+#include "Audio.h"
+#include <Poco/File.h>
+#include <Poco/Exception.h>
+#include <string.h>
+#include <math.h>
+using namespace std;
+
+static uint32_t readLE32( const uint8_t * p ){
+	return p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+
+static uint16_t readLE16( const uint8_t * p ){
+	return p[0] | (p[1]<<8);
+}
+
+static uint32_t readBE32( const uint8_t * p ){
+	return ((uint32_t)p[0]<<24) | (p[1]<<16) | (p[2]<<8) | p[3];
+}
+
+static uint16_t readBE16( const uint8_t * p ){
+	return (p[0]<<8) | p[1];
+}
+
+// aiff stores the sample rate as an 80 bit extended float
+static double readExtended( const uint8_t * p ){
+	int exponent = ((p[0]&0x7f)<<8) | p[1];
+	uint64_t mantissa = 0;
+	for( int i = 0; i < 8; i++ ){
+		mantissa = (mantissa<<8) | p[2+i];
+	}
+	if( exponent == 0 && mantissa == 0 ) return 0;
+	double value = ldexp( (double)mantissa, exponent - 16383 - 63 );
+	return (p[0]&0x80)? -value : value;
+}
+
+PcmFile::PcmFile() :
+	data(NULL), dataSize(0), encoding(INT16), bigEndian(false),
+	numChannels(0), sampleRate(0), bytesPerFrame(0), numFrames(0){
+}
+
+bool PcmFile::open( string fileName ){
+	close();
+	
+	const uint8_t * begin;
+	const uint8_t * end;
+	try{
+		Poco::File file(fileName);
+		if( !file.exists() || !file.isFile() || file.getSize() < 12 ) return false;
+		map = Poco::SharedMemory(file, Poco::SharedMemory::AM_READ);
+		begin = (const uint8_t*)map.begin();
+		end = (const uint8_t*)map.end();
+	}
+	catch( Poco::Exception & ){
+		close();
+		return false;
+	}
+	
+	bool ok = false;
+	if( memcmp(begin, "RIFF", 4) == 0 && memcmp(begin+8, "WAVE", 4) == 0 ){
+		ok = parseWav(begin, end);
+	}
+	else if( memcmp(begin, "FORM", 4) == 0 && (memcmp(begin+8, "AIFF", 4) == 0 || memcmp(begin+8, "AIFC", 4) == 0) ){
+		ok = parseAiff(begin, end);
+	}
+	
+	if( !ok || numChannels <= 0 || sampleRate <= 0 || data == NULL ){
+		close();
+		return false;
+	}
+	
+	bytesPerFrame *= numChannels;
+	// the header might claim more than there is (e.g. files that were still being written)
+	dataSize = min(dataSize, (int64_t)(end-data));
+	numFrames = dataSize/bytesPerFrame;
+	return true;
+}
+
+bool PcmFile::parseWav( const uint8_t * begin, const uint8_t * end ){
+	bool haveFormat = false;
+	const uint8_t * p = begin + 12;
+	while( p + 8 <= end ){
+		uint32_t size = readLE32(p+4);
+		const uint8_t * chunk = p + 8;
+		
+		if( memcmp(p, "fmt ", 4) == 0 && size >= 16 && chunk + 16 <= end ){
+			int format = readLE16(chunk);
+			numChannels = readLE16(chunk+2);
+			sampleRate = readLE32(chunk+4);
+			int bits = readLE16(chunk+14);
+			if( format == 0xFFFE && size >= 40 && chunk + 40 <= end ){
+				// WAVE_FORMAT_EXTENSIBLE, the real format is at the start of the sub format guid
+				format = readLE16(chunk+24);
+			}
+			// 1: integer pcm, 3: float
+			if( format != 1 && format != 3 ) return false;
+			if( !setFormat(bits, format == 3) ) return false;
+			haveFormat = true;
+		}
+		else if( memcmp(p, "data", 4) == 0 ){
+			if( !haveFormat ) return false;
+			data = chunk;
+			// streamed files sometimes leave the size at 0 or -1
+			dataSize = (size == 0 || size == 0xFFFFFFFF)? end - chunk : size;
+			bigEndian = false;
+			return true;
+		}
+		
+		// chunks are padded to an even size
+		p = chunk + size + (size&1);
+	}
+	return false;
+}
+
+bool PcmFile::parseAiff( const uint8_t * begin, const uint8_t * end ){
+	bool isAifc = memcmp(begin+8, "AIFC", 4) == 0;
+	bool haveFormat = false;
+	const uint8_t * p = begin + 12;
+	while( p + 8 <= end ){
+		uint32_t size = readBE32(p+4);
+		const uint8_t * chunk = p + 8;
+		
+		if( memcmp(p, "COMM", 4) == 0 && size >= 18 && chunk + 18 <= end ){
+			numChannels = readBE16(chunk);
+			int bits = readBE16(chunk+6);
+			sampleRate = (int)lround(readExtended(chunk+8));
+			bool isFloat = false;
+			bigEndian = true;
+			if( isAifc ){
+				if( size < 22 || chunk + 22 > end ) return false;
+				const uint8_t * compression = chunk+18;
+				if( memcmp(compression, "sowt", 4) == 0 ) bigEndian = false;
+				else if( memcmp(compression, "fl32", 4) == 0 || memcmp(compression, "FL32", 4) == 0 ) isFloat = true;
+				else if( memcmp(compression, "NONE", 4) != 0 ) return false;
+			}
+			if( !setFormat(isFloat? 32 : bits, isFloat) ) return false;
+			haveFormat = true;
+		}
+		else if( memcmp(p, "SSND", 4) == 0 && size >= 8 && chunk + 8 <= end ){
+			if( !haveFormat ) return false;
+			uint32_t offset = readBE32(chunk);
+			data = chunk + 8 + offset;
+			dataSize = (int64_t)size - 8 - offset;
+			return data <= end && dataSize >= 0;
+		}
+		
+		p = chunk + size + (size&1);
+	}
+	return false;
+}
+
+bool PcmFile::setFormat( int bits, bool isFloat ){
+	if( isFloat && bits == 32 ) encoding = FLOAT32;
+	else if( isFloat ) return false;
+	else if( bits == 16 ) encoding = INT16;
+	else if( bits == 24 ) encoding = INT24;
+	else if( bits == 32 ) encoding = INT32;
+	else return false;
+	bytesPerFrame = bits/8;
+	return true;
+}
+
+void PcmFile::close(){
+	map = Poco::SharedMemory();
+	data = NULL;
+	dataSize = 0;
+	numChannels = 0;
+	sampleRate = 0;
+	bytesPerFrame = 0;
+	numFrames = 0;
+}
+
+bool PcmFile::isOpen(){
+	return data != NULL;
+}
+
+int PcmFile::getNumChannels(){
+	return numChannels;
+}
+
+int PcmFile::getSampleRate(){
+	return sampleRate;
+}
+
+int64_t PcmFile::getNumFrames(){
+	return numFrames;
+}
+
+int PcmFile::read( int64_t pos, float * output, int N ){
+	if( data == NULL || pos < 0 || pos >= numFrames ) return 0;
+	N = (int)min((int64_t)N, numFrames-pos);
+	const uint8_t * src = data + pos*bytesPerFrame;
+	int numSamples = N*numChannels;
+	
+	if( !bigEndian ){
+		switch( encoding ){
+			case INT16:
+				AudioAlgo::int16_to_float(output, (const int16_t*)src, numSamples);
+				break;
+			case INT24:
+				AudioAlgo::int24_to_float(output, src, numSamples);
+				break;
+			case INT32:
+				for( int i = 0; i < numSamples; i++ ){
+					output[i] = (int32_t)readLE32(src+4*i)*(1.0f/2147483648.0f);
+				}
+				break;
+			case FLOAT32:
+				memcpy(output, src, numSamples*sizeof(float));
+				break;
+		}
+	}
+	else{
+		// big endian aiff, not common enough to bother with vectors
+		for( int i = 0; i < numSamples; i++ ){
+			switch( encoding ){
+				case INT16:
+					output[i] = (int16_t)readBE16(src+2*i)*(1.0f/32768);
+					break;
+				case INT24:
+					output[i] = ((int32_t)(((uint32_t)src[3*i]<<24) | (src[3*i+1]<<16) | (src[3*i+2]<<8))>>8)*(1.0f/8388608);
+					break;
+				case INT32:
+					output[i] = (int32_t)readBE32(src+4*i)*(1.0f/2147483648.0f);
+					break;
+				case FLOAT32:{
+					uint32_t v = readBE32(src+4*i);
+					memcpy(output+i, &v, sizeof(float));
+					break;
+				}
+			}
+		}
+	}
+	
+	return N;
+}
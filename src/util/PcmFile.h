@@ -0,0 +1,63 @@
+//
+//  PcmFile.h
+//  Oscilloscope
+//
+//  Uncompressed wav and aiff files, read straight from a memory mapping.
+//  There are no packets and no codec involved, and seeking is only a
+//  different offset into the mapping.
+//
+//  Only 16, 24 and 32 bit integer and 32 bit float samples are handled here.
+//  Everything else (compressed files, 8 bit, a-law, ...) is left to libav.
+//
+
+#ifndef Oscilloscope_PcmFile_h
+#define Oscilloscope_PcmFile_h
+
+#include <string>
+#include <stdint.h>
+#include <Poco/SharedMemory.h>
+
+class PcmFile{
+public:
+	PcmFile();
+	
+	// maps the file and parses the header.
+	// returns false if it isn't a file we can read directly.
+	bool open( std::string fileName );
+	void close();
+	bool isOpen();
+	
+	int getNumChannels();
+	int getSampleRate();
+	int64_t getNumFrames();
+	
+	// copies up to N frames, starting at frame pos, as interleaved float.
+	// returns the number of frames copied (0 at the end of the file).
+	int read( int64_t pos, float * output, int N );
+	
+private:
+	enum Encoding{
+		INT16,
+		INT24,
+		INT32,
+		FLOAT32
+	};
+	
+	bool parseWav( const uint8_t * begin, const uint8_t * end );
+	bool parseAiff( const uint8_t * begin, const uint8_t * end );
+	bool setFormat( int bits, bool isFloat );
+	
+	Poco::SharedMemory map;
+	// first sample, and the number of bytes of sample data after it
+	const uint8_t * data;
+	int64_t dataSize;
+	
+	Encoding encoding;
+	bool bigEndian;
+	int numChannels;
+	int sampleRate;
+	int bytesPerFrame;
+	int64_t numFrames;
+};
+
+#endif
@@ -36,9 +36,10 @@ public:
 		
 	}
 	
-	void setup( ofShader * shader, string baseName ){
+	// fragBaseName: take the fragment shader from somewhere else (shaders that only differ in the vertex stage)
+	void setup( ofShader * shader, string baseName, string fragBaseName = "" ){
 		this->shader = shader; 
-		fragFile = ofxToReadonlyDataPath(baseName + ".frag");
+		fragFile = ofxToReadonlyDataPath((fragBaseName == ""? baseName : fragBaseName) + ".frag");
 		vertFile = ofxToReadonlyDataPath(baseName + ".vert");
 		geomFile = ofxToReadonlyDataPath(baseName + ".geom");
 		
@@ -0,0 +1,46 @@
+//
+//  StreamingVbo.cpp
+//  Oscilloscope
+//
+
+#include "StreamingVbo.h"
+using namespace std;
+
+// smallest buffer, in vertices. grows when a single frame doesn't fit four times.
+#define STREAMING_VBO_MIN_CAPACITY (1<<16)
+
+StreamingVbo::StreamingVbo() : capacity(0), position(0){
+}
+
+void StreamingVbo::draw( ofMesh & mesh ){
+	vector<ofVec3f> & vertices = mesh.getVertices();
+	vector<ofFloatColor> & colors = mesh.getColors();
+	int n = vertices.size();
+	if( n == 0 ) return;
+	
+	if( 4*n > capacity ){
+		int size = STREAMING_VBO_MIN_CAPACITY;
+		while( size < 4*n ) size *= 2;
+		allocate(size);
+	}
+	else if( position + n > capacity ){
+		// orphan: the driver hands us fresh memory, the gpu keeps reading the old one
+		vertexBuffer.setData(capacity*sizeof(ofVec3f), NULL, GL_STREAM_DRAW);
+		colorBuffer.setData(capacity*sizeof(ofFloatColor), NULL, GL_STREAM_DRAW);
+		position = 0;
+	}
+	
+	vertexBuffer.updateData(position*sizeof(ofVec3f), n*sizeof(ofVec3f), vertices.data());
+	colorBuffer.updateData(position*sizeof(ofFloatColor), n*sizeof(ofFloatColor), colors.data());
+	vbo.draw(GL_TRIANGLES, position, n);
+	position += n;
+}
+
+void StreamingVbo::allocate( int capacity ){
+	vertexBuffer.allocate(capacity*sizeof(ofVec3f), GL_STREAM_DRAW);
+	colorBuffer.allocate(capacity*sizeof(ofFloatColor), GL_STREAM_DRAW);
+	vbo.setVertexBuffer(vertexBuffer, 3, sizeof(ofVec3f));
+	vbo.setColorBuffer(colorBuffer, sizeof(ofFloatColor));
+	this->capacity = capacity;
+	position = 0;
+}
@@ -0,0 +1,39 @@
+//
+//  StreamingVbo.h
+//  Oscilloscope
+//
+//  A fixed size vertex buffer that new triangles are streamed into, for the
+//  cpu path (the gpu path only streams samples, see GpuTraceRenderer).
+//
+//  ofMesh::draw() uploads the whole mesh into a fresh buffer on every call.
+//  Here every frame's vertices are written behind the previous frame's, and
+//  only that range is drawn. When the end of the buffer is reached it is
+//  orphaned (given a new, empty store of the same size) and writing starts over
+//  at zero, so we never wait for the gpu to finish with the old data.
+//
+
+#ifndef Oscilloscope_StreamingVbo_h
+#define Oscilloscope_StreamingVbo_h
+
+#include "ofMain.h"
+#include <vector>
+
+class StreamingVbo{
+public:
+	StreamingVbo();
+	
+	// appends the mesh's vertices and colors and draws just those as triangles
+	void draw( ofMesh & mesh );
+	
+private:
+	void allocate( int capacity );
+	
+	ofBufferObject vertexBuffer;
+	ofBufferObject colorBuffer;
+	ofVbo vbo;
+	// in vertices
+	int capacity;
+	int position;
+};
+
+#endif
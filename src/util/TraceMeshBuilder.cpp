@@ -0,0 +1,510 @@
+//
+//  TraceMeshBuilder.cpp
+//  Oscilloscope
+//
+
+#include "TraceMeshBuilder.h"
+using namespace std;
+
+#define EPS 1E-6
+
+// over budget, a block is decimated to at least 1/N of its samples
+#define MESH_BUILDER_MIN_LOD 16
+// how often the tolerance is doubled to make a block fit
+#define MESH_BUILDER_LOD_STEPS 8
+// the worker sleeps until samples arrive, but never longer than this (see WakeSignal)
+#define MESH_BUILDER_MAX_SLEEP_MS 5
+
+namespace{
+	// the quad from p0 to p1, extended by the line width at both ends.
+	// the colors tell the shader where in the quad we are (x/y), how long the segment is (z)
+	// and how much to weigh it (a).
+	inline void addSegment( ofVec3f * v, ofFloatColor * c, ofVec2f p0, ofVec2f p1, float uSize, float weight ){
+		ofVec2f dir = p1 - p0;
+		float z = dir.length();
+		if (z > EPS) dir /= z;
+		else dir = ofVec2f(1.0, 0.0);
+		
+		dir *= uSize;
+		ofVec2f norm(-dir.y, dir.x);
+		
+		v[0] = ofVec3f(p0-dir-norm);
+		c[0] = ofFloatColor(-uSize, -uSize, z, weight);
+		
+		v[1] = ofVec3f(p0-dir+norm);
+		c[1] = ofFloatColor(-uSize, uSize, z, weight);
+		
+		v[2] = ofVec3f(p1+dir-norm);
+		c[2] = ofFloatColor(z+uSize, -uSize, z, weight);
+		
+		v[3] = v[1];
+		c[3] = c[1];
+		
+		v[4] = v[2];
+		c[4] = c[2];
+		
+		v[5] = ofVec3f(p1+dir+norm);
+		c[5] = ofFloatColor(z+uSize, +uSize, z, weight);
+	}
+}
+
+TraceMeshBuilder::TraceMeshBuilder() :
+	dropped(0), decimated(0){
+}
+
+TraceMeshBuilder::~TraceMeshBuilder(){
+	stopThread();
+	wake();
+	waitForThread(false);
+}
+
+void TraceMeshBuilder::setSources( const vector<StereoSample*> & sources, bool isMono ){
+	lock();
+	settings.isMono = isMono;
+	if( sources.size() != traces.size() ){
+		traces.resize(sources.size());
+		settings.resets++;
+	}
+	for( size_t i = 0; i < sources.size(); i++ ){
+		Trace & trace = traces[i];
+		if( trace.source != sources[i] ){
+			// a different stream, whatever we had doesn't connect to it
+			trace.source = sources[i];
+			trace.vertices.clear();
+			trace.colors.clear();
+			trace.points.clear();
+			trace.last = ofVec2f();
+			settings.resets++;
+		}
+	}
+	unlock();
+}
+
+void TraceMeshBuilder::setBlockSize( int blockSize ){
+	lock();
+	settings.blockSize = MAX(2,blockSize);
+	unlock();
+}
+
+void TraceMeshBuilder::setStrokeWeight( float strokeWeight ){
+	lock();
+	settings.uSize = strokeWeight;
+	unlock();
+}
+
+void TraceMeshBuilder::setMaxVertices( int maxVertices ){
+	lock();
+	settings.maxVertices = maxVertices;
+	for( Trace & trace : traces ){
+		reserve(trace);
+	}
+	unlock();
+}
+
+void TraceMeshBuilder::setPixelTransforms( const vector<ofMatrix4x4> & transforms, float width, float height ){
+	lock();
+	settings.viewWidth = width;
+	settings.viewHeight = height;
+	for( size_t i = 0; i < traces.size(); i++ ){
+		Trace & trace = traces[i];
+		trace.hasPixels = i < transforms.size();
+		if( trace.hasPixels ){
+			// affine is all we use, so three points say it all
+			ofVec3f o = transforms[i].preMult(ofVec3f(0,0,0));
+			ofVec3f x = transforms[i].preMult(ofVec3f(1,0,0));
+			ofVec3f y = transforms[i].preMult(ofVec3f(0,1,0));
+			trace.pxOrigin = ofVec2f(o.x, o.y);
+			trace.pxX = ofVec2f(x.x-o.x, x.y-o.y);
+			trace.pxY = ofVec2f(y.x-o.x, y.y-o.y);
+		}
+	}
+	unlock();
+}
+
+void TraceMeshBuilder::setSync( bool sync ){
+	lock();
+	settings.sync = sync;
+	unlock();
+}
+
+void TraceMeshBuilder::setRawPoints( bool rawPoints ){
+	lock();
+	if( settings.rawPoints != rawPoints ){
+		settings.rawPoints = rawPoints;
+		for( Trace & trace : traces ){
+			trace.vertices.clear();
+			trace.colors.clear();
+			trace.points.clear();
+		}
+		settings.resets++;
+	}
+	unlock();
+}
+
+bool TraceMeshBuilder::update( vector<ofMesh> & meshes ){
+	lock();
+	bool sync = settings.sync;
+	unlock();
+	if( sync ){
+		build(false);
+	}
+	
+	lock();
+	meshes.resize(traces.size());
+	bool changed = false;
+	for( size_t i = 0; i < traces.size(); i++ ){
+		Trace & trace = traces[i];
+		ofMesh & mesh = meshes[i];
+		mesh.setMode(OF_PRIMITIVE_TRIANGLES);
+		mesh.enableColors();
+		
+		// the mesh gets the new vertices, the next hand over goes into the old mesh's memory
+		mesh.getVertices().swap(trace.vertices);
+		mesh.getColors().swap(trace.colors);
+		trace.vertices.clear();
+		trace.colors.clear();
+		reserve(trace);
+		
+		changed |= mesh.getNumVertices() > 0;
+	}
+	unlock();
+	
+	return changed;
+}
+
+bool TraceMeshBuilder::updatePoints( vector<vector<ofVec3f>> & points ){
+	lock();
+	bool sync = settings.sync;
+	unlock();
+	if( sync ){
+		build(false);
+	}
+	
+	lock();
+	points.resize(traces.size());
+	bool changed = false;
+	for( size_t i = 0; i < traces.size(); i++ ){
+		Trace & trace = traces[i];
+		points[i].swap(trace.points);
+		trace.points.clear();
+		reserve(trace);
+		
+		changed |= points[i].size() > 1;
+	}
+	unlock();
+	
+	return changed;
+}
+
+// room for the hard limit plus the block that goes over it, so handing over never reallocates
+void TraceMeshBuilder::reserve( Trace & trace ){
+	if( settings.maxVertices > 0 ){
+		if( settings.rawPoints ){
+			trace.points.reserve(2*settings.maxVertices/6 + settings.blockSize + 1);
+		}
+		else{
+			trace.vertices.reserve(2*settings.maxVertices + 6*settings.blockSize);
+			trace.colors.reserve(2*settings.maxVertices + 6*settings.blockSize);
+		}
+	}
+}
+
+void TraceMeshBuilder::threadedFunction(){
+	while( isThreadRunning() ){
+		// sleep until samples arrive
+		if( !wakeSignal.wait(MESH_BUILDER_MAX_SLEEP_MS) ){
+			continue;
+		}
+		
+		while( isThreadRunning() && build(true) );
+	}
+}
+
+void TraceMeshBuilder::wake(){
+	wakeSignal.wake();
+}
+
+namespace{
+	// the built data goes to the back buffer: swapped in if that's empty, otherwise
+	// added to the end (without the first skip elements)
+	template<typename T>
+	void handOver( vector<T> & to, vector<T> & from, size_t skip ){
+		if( to.empty() ) to.swap(from);
+		else if( from.size() > skip ) to.insert(to.end(), from.begin()+skip, from.end());
+		from.clear();
+	}
+}
+
+// turns all complete blocks into vertices. the lock is only taken to copy the
+// settings and traces at the start and to hand the result over at the end.
+// the worker skips this in sync mode, where update() calls it instead.
+// returns false if there was nothing to do.
+bool TraceMeshBuilder::build( bool worker ){
+	std::lock_guard<std::mutex> buildLock(buildMutex);
+	
+	lock();
+	if( worker && settings.sync ){
+		unlock();
+		return false;
+	}
+	current = settings;
+	building.resize(traces.size());
+	for( size_t i = 0; i < traces.size(); i++ ){
+		const Trace & from = traces[i];
+		Trace & to = building[i];
+		to.source = from.source;
+		to.waiting = current.rawPoints? (int)from.points.size() : (int)from.vertices.size()/6;
+		to.last = from.last;
+		to.tolerance = from.tolerance;
+		to.hasPixels = from.hasPixels;
+		to.pxOrigin = from.pxOrigin;
+		to.pxX = from.pxX;
+		to.pxY = from.pxY;
+	}
+	unlock();
+	
+	bool worked = false;
+	for( Trace & trace : building ){
+		worked |= buildTrace(trace);
+	}
+	if( !worked ) return false;
+	
+	lock();
+	// if the traces were reset meanwhile, this doesn't connect to anything
+	if( settings.resets == current.resets ){
+		for( size_t i = 0; i < traces.size(); i++ ){
+			Trace & to = traces[i];
+			Trace & from = building[i];
+			handOver(to.vertices, from.vertices, 0);
+			handOver(to.colors, from.colors, 0);
+			// in raw mode the first point is where the last build ended, which the back buffer has already
+			handOver(to.points, from.points, 1);
+			to.last = from.last;
+			to.tolerance = from.tolerance;
+		}
+	}
+	unlock();
+	
+	for( Trace & trace : building ){
+		trace.vertices.clear();
+		trace.colors.clear();
+		trace.points.clear();
+	}
+	return true;
+}
+
+// turns the complete blocks of one trace into vertices (or points).
+// returns false if there was nothing to do.
+bool TraceMeshBuilder::buildTrace( Trace & trace ){
+	bool worked = false;
+	// in segments
+	int budget = current.maxVertices/6;
+	StereoSample & samples = *trace.source;
+	while( samples.totalLength >= current.blockSize ){
+		// read the samples right where they are, no copying
+		MonoSample::Span leftSpan, rightSpan;
+		samples.peekSpan(current.blockSize, leftSpan, rightSpan);
+		int n = leftSpan.size();
+		
+		auto samplePt = [&]( int i ){
+			if(current.isMono) return ofVec2f(-1+2*i/(float)current.blockSize, rightSpan[i]);
+			else return ofVec2f(leftSpan[i], rightSpan[i]);
+		};
+		
+		int have = trace.waiting + (current.rawPoints? (int)trace.points.size() : (int)trace.vertices.size()/6);
+		if( budget > 0 && have >= 2*budget ){
+			// the gl thread isn't picking anything up at all
+			dropped ++;
+		}
+		else{
+			blockIn.resize(n);
+			for( int i = 0; i < n; i++ ){
+				ofVec2f p = samplePt(i);
+				blockIn[i] = ofVec3f(p.x, p.y, 1);
+			}
+			int m = n;
+			
+			if( trace.hasPixels ){
+				m = cullAndMerge(trace, n);
+				blockIn.swap(blockOut);
+			}
+			
+			// the result always ends up in blockOut
+			if( budget == 0 || have + m <= budget ){
+				blockOut.swap(blockIn);
+				trace.tolerance /= 2;
+			}
+			else{
+				// whatever room is left, but at least a fraction of the block
+				int room = MAX(budget - have, n/MESH_BUILDER_MIN_LOD);
+				float tolerance = MAX(trace.tolerance/2, current.uSize/4);
+				int merged = m;
+				m = decimate(merged, trace.last, tolerance);
+				for( int k = 0; m > room && k < MESH_BUILDER_LOD_STEPS; k++ ){
+					tolerance *= 2;
+					m = decimate(merged, trace.last, tolerance);
+				}
+				trace.tolerance = tolerance;
+				decimated ++;
+			}
+			
+			if( current.rawPoints ){
+				if( trace.points.empty() ){
+					trace.points.push_back(ofVec3f(trace.last.x, trace.last.y, 1));
+				}
+				trace.points.insert(trace.points.end(), blockOut.begin(), blockOut.begin()+m);
+			}
+			else{
+				size_t start = trace.vertices.size();
+				trace.vertices.resize(start + 6*m);
+				trace.colors.resize(start + 6*m);
+				ofVec3f * v = trace.vertices.data() + start;
+				ofFloatColor * c = trace.colors.data() + start;
+				
+				ofVec2f p0 = trace.last;
+				for( int i = 0; i < m; i++ ){
+					ofVec2f p1(blockOut[i].x, blockOut[i].y);
+					addSegment(v+6*i, c+6*i, p0, p1, current.uSize, blockOut[i].z);
+					p0 = p1;
+				}
+			}
+			trace.last = ofVec2f(blockOut[m-1].x, blockOut[m-1].y);
+		}
+		
+		samples.consume(n);
+		worked = true;
+	}
+	return worked;
+}
+
+// merges runs of blockIn into single segments and writes them to blockOut.
+// a run continues as long as the samples stay within the tolerance of the point
+// where it started, or of the line through its first sample beyond that, without
+// going back along the line. start is where the previous block ended.
+// returns the number of points written.
+int TraceMeshBuilder::decimate( int n, ofVec2f start, float tolerance ){
+	blockOut.resize(n);
+	int m = 0;
+	
+	ofVec2f a = start;
+	ofVec2f end = start;
+	ofVec2f dir;
+	bool hasDir = false;
+	float maxT = 0;
+	// number of segments in the run (by weight)
+	float count = 0;
+	
+	auto emit = [&](){
+		blockOut[m++] = ofVec3f(end.x, end.y, count);
+	};
+	
+	for( int i = 0; i < n; i++ ){
+		ofVec2f p(blockIn[i].x, blockIn[i].y);
+		ofVec2f d = p - a;
+		bool fits = true;
+		if( hasDir ){
+			float t = d.x*dir.x + d.y*dir.y;
+			float perp = fabsf(d.x*dir.y - d.y*dir.x);
+			fits = perp <= tolerance && t >= maxT - tolerance;
+			maxT = MAX(maxT, t);
+		}
+		
+		if( !fits ){
+			// the run ends at the previous sample, the next one starts there
+			emit();
+			a = end;
+			d = p - a;
+			count = 0;
+			hasDir = false;
+		}
+		
+		count += blockIn[i].z;
+		end = p;
+		if( !hasDir ){
+			float len = d.length();
+			if( len > tolerance ){
+				dir = d/len;
+				maxT = len;
+				hasDir = true;
+			}
+		}
+	}
+	emit();
+	
+	return m;
+}
+
+// the pixel space pre-pass, from blockIn to blockOut. merges runs of samples that
+// stay within half a pixel of where they started into a single short segment (with
+// the weights added up), and runs that stay outside the same edge of the viewport
+// into a single invisible one. returns the number of points written.
+// the segments of a run all look alike to the shader, and it applies the weight after
+// its pow() curve and premultiplied, so the merged segment is as bright as the run.
+int TraceMeshBuilder::cullAndMerge( Trace & trace, int n ){
+	blockOut.resize(n);
+	int m = 0;
+	
+	auto toPixels = [&]( ofVec2f p ){
+		return trace.pxOrigin + trace.pxX*p.x + trace.pxY*p.y;
+	};
+	// the line is uSize wide on both sides, plus a pixel for the glow
+	float margin = current.uSize*trace.pxX.length() + 1;
+	auto outside = [&]( ofVec2f q ){
+		return (q.x < -margin? 1 : 0) | (q.x > current.viewWidth + margin? 2 : 0) |
+			(q.y < -margin? 4 : 0) | (q.y > current.viewHeight + margin? 8 : 0);
+	};
+	
+	enum{ NONE, DOT, CULL };
+	ofVec2f a = trace.last;
+	ofVec2f aPx = toPixels(a);
+	int aOut = outside(aPx);
+	ofVec2f end;
+	int kind = NONE;
+	int sides = 0;
+	float count = 0;
+	
+	auto emit = [&](){
+		blockOut[m++] = ofVec3f(end.x, end.y, kind == CULL? 0 : count);
+		a = end;
+		aPx = toPixels(a);
+		aOut = outside(aPx);
+		kind = NONE;
+		count = 0;
+	};
+	
+	for( int i = 0; i < n; i++ ){
+		ofVec2f p(blockIn[i].x, blockIn[i].y);
+		ofVec2f q = toPixels(p);
+		int out = outside(q);
+		
+		if( kind == DOT && (q-aPx).length() > 0.5f ) emit();
+		else if( kind == CULL && (sides & out) == 0 ) emit();
+		
+		if( kind == NONE ){
+			if( aOut & out ){
+				kind = CULL;
+				sides = aOut & out;
+			}
+			else if( (q-aPx).length() <= 0.5f ){
+				kind = DOT;
+			}
+			else{
+				// a regular segment, passed on as it is
+				blockOut[m++] = blockIn[i];
+				a = p;
+				aPx = q;
+				aOut = out;
+				continue;
+			}
+		}
+		
+		if( kind == CULL ) sides &= out;
+		count += blockIn[i].z;
+		end = p;
+	}
+	if( kind != NONE ){
+		emit();
+	}
+	
+	return m;
+}
@@ -0,0 +1,140 @@
+//
+//  TraceMeshBuilder.h
+//  Oscilloscope
+//
+//  Turns the render stream into triangles on a worker thread.
+//
+//  Every pair of samples becomes a quad (two triangles, six vertices).
+//  At 192kHz that's over a million vertices per second, which we don't want
+//  to build on the gl thread. The worker sleeps until wake() says samples arrived,
+//  builds the blocks into its own buffers without holding the lock, and then hands
+//  them over to the back buffer of each trace. update() swaps that buffer with the
+//  mesh's own vertices, so the gl thread only swaps and uploads.
+//
+//  In raw mode the worker only collects the points and the quads are built in the
+//  vertex shader instead (see GpuTraceRenderer).
+//
+//  When a trace goes over its vertex budget, the blocks are decimated instead of
+//  dropped: runs of samples that stay within a small tolerance of a straight line
+//  (or of a single point) become one segment. The shader gives every segment the same
+//  total brightness whatever its length (the beam spends the same time on each), so
+//  the merged segment is weighted by the number of segments it stands for. The
+//  shader puts the weight into the premultiplied color, so it adds up the same in an
+//  8 bit fbo as in a float one. The tolerance adapts per trace until the blocks fit.
+//
+//  Before that, with pixel transforms set, runs of samples that stay within half a
+//  pixel become a single weighted dot, and runs that stay off screen (beyond the same
+//  edge) a single invisible segment. At 192kHz most samples are that close together,
+//  so this alone cuts most of the quads and the overdraw in the fragment shader.
+//
+
+#ifndef Oscilloscope_TraceMeshBuilder_h
+#define Oscilloscope_TraceMeshBuilder_h
+
+#include "ofMain.h"
+#include "Audio.h"
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+class TraceMeshBuilder : public ofThread{
+public:
+	TraceMeshBuilder();
+	~TraceMeshBuilder();
+	
+	// where the samples come from, one source per trace.
+	// the builder becomes the only reader of these.
+	void setSources( const std::vector<StereoSample*> & sources, bool isMono );
+	// samples are turned into vertices in blocks of this size
+	void setBlockSize( int blockSize );
+	// line width, in the same units as the samples
+	void setStrokeWeight( float strokeWeight );
+	// when the vertices of a trace pile up beyond this (e.g. because the gl thread is
+	// busy), blocks are decimated. beyond twice this they are dropped. 0 keeps everything.
+	void setMaxVertices( int maxVertices );
+	// maps the samples of each trace to pixels in a viewport of the given size
+	// (the trace's matrix followed by the viewport transform). leave empty to skip the
+	// pixel space pre-pass.
+	void setPixelTransforms( const std::vector<ofMatrix4x4> & transforms, float width, float height );
+	// in sync mode the worker stays idle and update() builds everything itself.
+	// that's for exporting, where every frame has to contain exactly the samples up to it.
+	void setSync( bool sync );
+	// collect the points only, for updatePoints(), instead of building meshes.
+	// switching drops whatever was built so far.
+	void setRawPoints( bool rawPoints );
+	
+	// moves the vertices built since the last call into the meshes (one per source).
+	// returns true if there were any.
+	bool update( std::vector<ofMesh> & meshes );
+	// same, in raw mode. each trace starts with the last point of the previous call,
+	// so n points make n-1 segments. z is the weight of the segment ending at that point.
+	bool updatePoints( std::vector<std::vector<ofVec3f>> & points );
+	// tells the worker that samples were added to the sources. never blocks, safe to
+	// call from the audio callback.
+	void wake();
+	
+	// number of blocks that were dropped
+	std::atomic<int> dropped;
+	// number of blocks that were decimated
+	std::atomic<int> decimated;
+	
+	void threadedFunction();
+	
+private:
+	bool build( bool worker );
+	int decimate( int n, ofVec2f start, float tolerance );
+	
+	struct Trace{
+		StereoSample * source{NULL};
+		// handed over by build(), swapped into the mesh by update()
+		std::vector<ofVec3f> vertices;
+		std::vector<ofFloatColor> colors;
+		// same, in raw mode
+		std::vector<ofVec3f> points;
+		// segments waiting for update() when the build started (the build's copy only)
+		int waiting{0};
+		// where the last block ended, so the next one connects to it
+		ofVec2f last;
+		// decimation tolerance that made the last block fit
+		float tolerance{0};
+		// from samples to pixels (origin and where the x/y axis go)
+		bool hasPixels{false};
+		ofVec2f pxOrigin, pxX, pxY;
+	};
+	
+	bool buildTrace( Trace & trace );
+	int cullAndMerge( Trace & trace, int n );
+	
+	void reserve( Trace & trace );
+	
+	// what the setters change
+	struct Settings{
+		bool isMono{false};
+		bool sync{false};
+		bool rawPoints{false};
+		int blockSize{2084};
+		int maxVertices{0};
+		float uSize{0.01f};
+		float viewWidth{0};
+		float viewHeight{0};
+		// counts how often the traces were reset. a build that ran meanwhile is thrown away.
+		int resets{0};
+	};
+	
+	// shared with the worker, under the lock
+	std::vector<Trace> traces;
+	Settings settings;
+	
+	// only touched by build(), which holds buildMutex: the settings and traces as they
+	// were when the build started, with the vertices built since.
+	std::mutex buildMutex;
+	Settings current;
+	std::vector<Trace> building;
+	// the current block, before and after decimation (x, y, weight)
+	std::vector<ofVec3f> blockIn;
+	std::vector<ofVec3f> blockOut;
+	
+	WakeSignal wakeSignal;
+};
+
+#endif